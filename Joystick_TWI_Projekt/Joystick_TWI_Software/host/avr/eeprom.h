@@ -0,0 +1,39 @@
+/******************************************************************************\
+*                                                                              *
+* File        : avr/eeprom.h (host simulation)                                 *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host, stands in for the ATtiny2313                       *
+* Description : EEMEM data is collected in section 'sim_eemem'. The makefile   *
+*               links this section to an address with the lower 16 bits being  *
+*               zero, thus the address of an EEMEM variable truncated to EEAR  *
+*               equals its EEPROM address on the target. The simulator copies  *
+*               the section into the simulated EEPROM at start up (same as     *
+*               programming the .eep file).                                    *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __HOST_AVR_EEPROM_H__
+#define __HOST_AVR_EEPROM_H__
+
+#include <avr/io.h>
+
+#define   EEMEM                 __attribute__((section("sim_eemem")))
+
+#endif // #ifndef __HOST_AVR_EEPROM_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,42 @@
+/******************************************************************************\
+*                                                                              *
+* File        : avr/interrupt.h (host simulation)                              *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host, stands in for the ATtiny2313                       *
+* Description : Interrupt handling of the host simulation. An ISR becomes a    *
+*               plain function the simulator calls. sei() also passes control  *
+*               to the simulator: simulated time advances and any interrupt    *
+*               that became due meanwhile is served there.                     *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __HOST_AVR_INTERRUPT_H__
+#define __HOST_AVR_INTERRUPT_H__
+
+#include <avr/io.h>
+
+void sim_sei (void);
+
+#define   ISR(vector, ...)      void vector (void); \
+                                void vector (void)
+#define   sei()                 sim_sei()
+#define   cli()                 (SREG &= ~(1 << SREG_I))
+
+#endif // #ifndef __HOST_AVR_INTERRUPT_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,197 @@
+/******************************************************************************\
+*                                                                              *
+* File        : avr/io.h (host simulation)                                     *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host, stands in for the ATtiny2313                       *
+* Description : Hardware abstraction for building the firmware on a PC. Takes  *
+*               the place of the avr-libc header when 'host' is in front of    *
+*               the include path. Every IO register the firmware uses is a     *
+*               plain variable owned by the simulator (sim.c). Registers with  *
+*               side effects on access are mapped as follows:                  *
+*                EEDR   - directly addresses the simulated EEPROM at EEAR      *
+*                TIFR   - 16 bit, the simulator keeps bit 8 set; a write by    *
+*                         the firmware clears it and is taken as "write 1 to   *
+*                         clear" when the simulator looks next time            *
+*                UDR    - same trick, a write is a byte to transmit            *
+*                USISR  - same trick, flags are "write 1 to clear" as well     *
+*                EECR,  - polled by busy loops, so every access is a function  *
+*                UCSRA,   call letting simulated time proceed a few clocks,    *
+*                PINB,    the PINx registers reflect the levels driven by the  *
+*                PIND     script (buttons, /RTS, I²C lines), writes get lost   *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __HOST_AVR_IO_H__
+#define __HOST_AVR_IO_H__
+
+#include <stdint.h>
+
+#ifndef __AVR_ATtiny2313__
+#error: host simulation only models the ATtiny2313!
+#endif
+
+#ifndef SIM_REG
+#define SIM_REG                 extern
+#endif
+
+/* ######## IO registers ######## */
+SIM_REG volatile uint8_t  SREG;
+SIM_REG volatile uint8_t  PORTB, DDRB;
+SIM_REG volatile uint8_t  PORTD, DDRD;
+SIM_REG volatile uint8_t  ACSR, DIDR;
+SIM_REG volatile uint8_t  TCCR1A, TCCR1B, TIMSK;
+SIM_REG volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+SIM_REG volatile uint16_t TIFR;
+SIM_REG volatile uint8_t  TCCR0A, TCCR0B, TCNT0;
+SIM_REG volatile uint16_t EEAR;
+SIM_REG volatile uint8_t  UCSRB, UCSRC, UBRRH, UBRRL;
+SIM_REG volatile uint16_t UDR;
+SIM_REG volatile uint8_t  USICR, USIDR;
+SIM_REG volatile uint16_t USISR;
+SIM_REG volatile uint8_t  MCUSR, WDTCSR;
+
+#define   E2END                 0x7F
+#define   RAMEND                0xDF
+SIM_REG uint8_t sim_eeprom[E2END + 1];
+#define   EEDR                  sim_eeprom[EEAR & E2END]
+
+volatile uint8_t *sim_eecr (void);
+volatile uint8_t *sim_ucsra (void);
+volatile uint8_t *sim_pinb (void);
+volatile uint8_t *sim_pind (void);
+#define   EECR                  (*sim_eecr())
+#define   UCSRA                 (*sim_ucsra())
+#define   PINB                  (*sim_pinb())
+#define   PIND                  (*sim_pind())
+
+/* ######## bit positions ######## */
+#define   PB0                   0
+#define   PB1                   1
+#define   PB2                   2
+#define   PB3                   3
+#define   PB4                   4
+#define   PB5                   5
+#define   PB6                   6
+#define   PB7                   7
+#define   PD0                   0
+#define   PD1                   1
+#define   PD2                   2
+#define   PD3                   3
+#define   PD4                   4
+#define   PD5                   5
+#define   PD6                   6
+/* SREG */
+#define   SREG_I                7
+/* ACSR */
+#define   ACD                   7
+#define   ACBG                  6
+#define   ACO                   5
+#define   ACI                   4
+#define   ACIE                  3
+#define   ACIC                  2
+#define   ACIS1                 1
+#define   ACIS0                 0
+/* DIDR */
+#define   AIN1D                 1
+#define   AIN0D                 0
+/* TCCR1B */
+#define   ICNC1                 7
+#define   ICES1                 6
+#define   WGM13                 4
+#define   WGM12                 3
+#define   CS12                  2
+#define   CS11                  1
+#define   CS10                  0
+/* TIMSK */
+#define   TOIE1                 7
+#define   OCIE1A                6
+#define   OCIE1B                5
+#define   ICIE1                 3
+#define   OCIE0B                2
+#define   TOIE0                 1
+#define   OCIE0A                0
+/* TIFR */
+#define   TOV1                  7
+#define   OCF1A                 6
+#define   OCF1B                 5
+#define   ICF1                  3
+#define   OCF0B                 2
+#define   TOV0                  1
+#define   OCF0A                 0
+/* TCCR0B */
+#define   CS02                  2
+#define   CS01                  1
+#define   CS00                  0
+/* EECR */
+#define   EEPM1                 5
+#define   EEPM0                 4
+#define   EERIE                 3
+#define   EEMPE                 2
+#define   EEPE                  1
+#define   EERE                  0
+/* UCSRA */
+#define   RXC                   7
+#define   TXC                   6
+#define   UDRE                  5
+#define   FE                    4
+#define   DOR                   3
+#define   UPE                   2
+#define   U2X                   1
+#define   MPCM                  0
+/* UCSRB */
+#define   RXCIE                 7
+#define   TXCIE                 6
+#define   UDRIE                 5
+#define   RXEN                  4
+#define   TXEN                  3
+#define   UCSZ2                 2
+#define   RXB8                  1
+#define   TXB8                  0
+/* USICR */
+#define   USISIE                7
+#define   USIOIE                6
+#define   USIWM1                5
+#define   USIWM0                4
+#define   USICS1                3
+#define   USICS0                2
+#define   USICLK                1
+#define   USITC                 0
+/* USISR */
+#define   USISIF                7
+#define   USIOIF                6
+#define   USIPF                 5
+#define   USIDC                 4
+#define   USICNT0               0
+/* MCUSR */
+#define   WDRF                  3
+#define   BORF                  2
+#define   EXTRF                 1
+#define   PORF                  0
+/* WDTCSR */
+#define   WDIF                  7
+#define   WDIE                  6
+#define   WDP3                  5
+#define   WDCE                  4
+#define   WDE                   3
+#define   WDP2                  2
+#define   WDP1                  1
+#define   WDP0                  0
+
+#endif // #ifndef __HOST_AVR_IO_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
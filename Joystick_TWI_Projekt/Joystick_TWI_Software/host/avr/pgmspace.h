@@ -0,0 +1,36 @@
+/******************************************************************************\
+*                                                                              *
+* File        : avr/pgmspace.h (host simulation)                               *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host, stands in for the ATtiny2313                       *
+* Description : FLASH tables of the host simulation are ordinary constants,    *
+*               reading them is a plain memory access.                         *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __HOST_AVR_PGMSPACE_H__
+#define __HOST_AVR_PGMSPACE_H__
+
+#include <stdint.h>
+
+#define   PROGMEM
+#define   pgm_read_byte(address) (*(const uint8_t*)(address))
+
+#endif // #ifndef __HOST_AVR_PGMSPACE_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
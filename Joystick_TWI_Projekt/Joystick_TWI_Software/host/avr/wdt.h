@@ -0,0 +1,51 @@
+/******************************************************************************\
+*                                                                              *
+* File        : avr/wdt.h (host simulation)                                    *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host, stands in for the ATtiny2313                       *
+* Description : Watchdog of the host simulation. The simulator keeps the       *
+*               deadline and reports a watchdog reset if the firmware misses   *
+*               it (the firmware goes on running).                             *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __HOST_AVR_WDT_H__
+#define __HOST_AVR_WDT_H__
+
+#include <avr/io.h>
+
+#define   WDTO_15MS             0
+#define   WDTO_30MS             1
+#define   WDTO_60MS             2
+#define   WDTO_120MS            3
+#define   WDTO_250MS            4
+#define   WDTO_500MS            5
+#define   WDTO_1S               6
+#define   WDTO_2S               7
+#define   WDTO_4S               8
+#define   WDTO_8S               9
+
+void sim_wdt_enable (uint8_t period);
+void sim_wdt_reset (void);
+
+#define   wdt_enable(period)    sim_wdt_enable(period)
+#define   wdt_reset()           sim_wdt_reset()
+
+#endif // #ifndef __HOST_AVR_WDT_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,422 @@
+/******************************************************************************\
+*                                                                              *
+* File        : bench.c                                                        *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     : simavr by Michel Pollet                                        *
+* License     :                                                                *
+* Target      : Linux host, needs simavr and libelf                            *
+* Description : Cycle counts of the time critical parts of joystick_twi.elf,   *
+*               taken on the ATtiny2313 simulated by simavr:                   *
+*                - TIMER1_COMPA_vect, TIMER1_COMPB_vect, TIMER0_OVF_vect       *
+*                  from vector to RETI, worst case of all runs                 *
+*                - rescale_capture(), one rescale pass of the main loop,       *
+*                  IRQs hitting it are not counted                             *
+*                - readJoyAll, sum of the USI IRQs serving a complete          *
+*                  transaction (write command, read 5 bytes)                   *
+*                - stack, bytes below RAMEND the stack pointer reached at most *
+*                  in all runs (main loop plus the IRQs)                       *
+*               Each of them is checked against a budget given on the command  *
+*               line as <name>=<clocks> (bytes for the stack), the exit code   *
+*               is 1 if any budget is exceeded or a measurement is missing.    *
+*               Also printed are the values IRQ_RESPONSE_CLOCKS and            *
+*               IRQ_REINIT_DELAY_CLKS of joystick_twi.h stand for:             *
+*                - compare match of timer 1 to the vector being taken          *
+*                - COMPB vector to timer 1 running again                       *
+*               The pots are not simulated, every other capture the ICP flag   *
+*               and ICR1 are set when TIMER1_COMPA_vect is entered, so both    *
+*               paths of the ISR are taken. The I²C master is emulated by      *
+*               writing USIDR/USISR and raising the USI vectors by hand.       *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_interrupts.h"
+#include "sim_regbit.h"
+#include "../../project.h"
+
+#ifndef F_CPU
+#define F_CPU                   4000000UL
+#endif
+#ifndef F_TWI
+#define F_TWI                   100000UL
+#endif
+
+/* ATtiny2313 data space addresses (IO address + 0x20) */
+#define   BENCH_USICR           0x2D
+#define   BENCH_USISR           0x2E
+#define   BENCH_USIDR           0x2F
+#define   BENCH_DDRB            0x37
+#define   BENCH_ICR1L           0x44
+#define   BENCH_ICR1H           0x45
+#define   BENCH_TCCR1B          0x4E
+#define   BENCH_TIFR            0x58
+#define   BENCH_SPL             0x5D
+#define   BENCH_SPH             0x5E
+#define   BENCH_RAMEND          0xDF
+/* bits */
+#define   BENCH_PB5             5       /* SDA */
+#define   BENCH_USISIE          7
+#define   BENCH_USIOIE          6
+#define   BENCH_USISIF          7
+#define   BENCH_USIOIF          6
+#define   BENCH_USIPF           5
+#define   BENCH_ICF1            3
+#define   BENCH_OCF1A           6
+#define   BENCH_OCF1B           5
+/* vectors, 2 bytes each */
+#define   BENCH_VECTORS         19
+#define   BENCH_TIMER1_COMPA    4
+#define   BENCH_TIMER0_OVF      6
+#define   BENCH_TIMER1_COMPB    12
+#define   BENCH_USI_START       15
+#define   BENCH_USI_OVERFLOW    16
+
+#define   BENCH_RUN_CLOCKS      (F_CPU / 10)      /* 100ms */
+#define   BENCH_TWI_BIT_CLKS    (F_CPU / F_TWI)
+#define   BENCH_CAPTURE         2241              /* pot at mid scale */
+
+
+/* ########################################################################## */
+// measurements and budgets
+enum
+{
+  benchCompA,
+  benchCompB,
+  benchT0Ovf,
+  benchRescale,
+  benchReadJoyAll,
+  benchStack,
+  benchCount,
+};
+
+static struct
+{
+  const char *name;
+  unsigned long budget;                     /* 0: none given */
+  unsigned long count;
+  unsigned long long max;
+} bench[benchCount] =
+{
+  {"TIMER1_COMPA_vect"},
+  {"TIMER1_COMPB_vect"},
+  {"TIMER0_OVF_vect"},
+  {"rescale_capture"},
+  {"readJoyAll"},
+  {"stack"},
+};
+
+static const int isrOfVector[BENCH_VECTORS] =
+{
+  [BENCH_TIMER1_COMPA] = benchCompA + 1,
+  [BENCH_TIMER0_OVF]   = benchT0Ovf + 1,
+  [BENCH_TIMER1_COMPB] = benchCompB + 1,
+};
+
+
+/* ########################################################################## */
+// stepping the simulated MCU, IRQs and function calls are tracked by the
+// stack pointer: they are finished as soon as their return address is popped
+static avr_t *avr;
+static uint32_t rescaleAddress;
+
+static struct
+{
+  int vector;                               /* 0: not in ISR */
+  uint16_t sp;
+  avr_cycle_count_t start;
+} isr;
+
+static struct
+{
+  int active;
+  uint16_t sp;
+  avr_cycle_count_t start;
+  avr_cycle_count_t irqClocks;              /* spent in ISRs meanwhile */
+} fn;
+
+static unsigned long usiClocks;             /* USI ISRs, summed up */
+static int captureToggle;
+static avr_cycle_count_t compareMatchAt[2];
+static unsigned long long responseSum, responseCount;
+static unsigned long long reinitSum, reinitCount;
+static int reinitPending;
+static uint16_t spLowest = BENCH_RAMEND;
+
+static uint16_t sp (void)
+{
+  return (avr->data[BENCH_SPL] | (avr->data[BENCH_SPH] << 8));
+}
+
+static void record (int index, avr_cycle_count_t clocks)
+{
+  bench[index].count++;
+  if (clocks > bench[index].max)
+    bench[index].max = clocks;
+}
+
+static void isrEnter (int vector)
+{
+  isr.vector = vector;
+  isr.sp = sp();
+  isr.start = avr->cycle;
+  if ((vector == BENCH_TIMER1_COMPA) || (vector == BENCH_TIMER1_COMPB))
+  {
+    avr_cycle_count_t match = compareMatchAt[vector == BENCH_TIMER1_COMPB];
+    if (match)
+    {
+      responseSum += avr->cycle - match;
+      responseCount++;
+    }
+  }
+  if (vector == BENCH_TIMER1_COMPA)
+  { /* let every other capture succeed */
+    if ((captureToggle ^= 1))
+    {
+      avr->data[BENCH_ICR1L] = BENCH_CAPTURE & 0xFF;
+      avr->data[BENCH_ICR1H] = BENCH_CAPTURE >> 8;
+      avr->data[BENCH_TIFR] |= (1 << BENCH_ICF1);
+    }
+  }
+  if (vector == BENCH_TIMER1_COMPB)
+    reinitPending = 1;
+}
+
+static void isrLeave (void)
+{
+  avr_cycle_count_t clocks = avr->cycle - isr.start;
+  int index = isrOfVector[isr.vector];
+  if (index)
+    record(index - 1, clocks);
+  if ((isr.vector == BENCH_USI_START) || (isr.vector == BENCH_USI_OVERFLOW))
+    usiClocks += clocks;
+  if (fn.active)
+    fn.irqClocks += clocks;
+  isr.vector = 0;
+}
+
+static void step (void)
+{
+  uint8_t tifr = avr->data[BENCH_TIFR];
+  int state = avr_run(avr);
+  if ((state == cpu_Done) || (state == cpu_Crashed))
+  {
+    fprintf(stderr, "simulated MCU stopped (state %d) at pc 0x%04x\n",
+      state, avr->pc);
+    exit(2);
+  }
+  if (sp() < spLowest)
+    spLowest = sp();
+  /* compare matches */
+  uint8_t rising = avr->data[BENCH_TIFR] & ~tifr;
+  if (rising & (1 << BENCH_OCF1A))
+    compareMatchAt[0] = avr->cycle;
+  if (rising & (1 << BENCH_OCF1B))
+    compareMatchAt[1] = avr->cycle;
+  /* ISRs */
+  if (isr.vector)
+  {
+    if (reinitPending && (avr->data[BENCH_TCCR1B] & 0x07))
+    {
+      reinitSum += avr->cycle - isr.start;
+      reinitCount++;
+      reinitPending = 0;
+    }
+    if (sp() > isr.sp)
+      isrLeave();
+  }
+  else if ((avr->pc < 2 * BENCH_VECTORS) && (avr->pc >= 2))
+    isrEnter(avr->pc / 2);
+  /* rescale pass */
+  if (fn.active)
+  {
+    if (!isr.vector && (sp() > fn.sp))
+    {
+      record(benchRescale, avr->cycle - fn.start - fn.irqClocks);
+      fn.active = 0;
+    }
+  }
+  else if (rescaleAddress && (avr->pc == rescaleAddress))
+  {
+    fn.active = 1;
+    fn.sp = sp();
+    fn.start = avr->cycle;
+    fn.irqClocks = 0;
+  }
+}
+
+static void run (avr_cycle_count_t clocks)
+{
+  avr_cycle_count_t end = avr->cycle + clocks;
+  while ((avr->cycle < end) || isr.vector)
+    step();
+}
+
+
+/* ########################################################################## */
+// I²C master, same sequence as host/sim.c clocks the USI
+static avr_int_vector_t usiStart =
+{
+  .vector = BENCH_USI_START,
+  .enable = AVR_IO_REGBIT(BENCH_USICR, BENCH_USISIE),
+};
+static avr_int_vector_t usiOverflow =
+{
+  .vector = BENCH_USI_OVERFLOW,
+  .enable = AVR_IO_REGBIT(BENCH_USICR, BENCH_USIOIE),
+};
+
+static void usiEvent (avr_int_vector_t *vector, uint8_t flag, int bits)
+{
+  avr->data[BENCH_USISR] |= (1 << flag);
+  if (avr->data[BENCH_USICR] & (1 << (vector->enable.bit)))
+  {
+    avr_raise_interrupt(avr, vector);
+    while (!isr.vector || (isr.vector != vector->vector))
+      step();                               /* SCL held low meanwhile */
+    while (isr.vector)
+      step();
+  }
+  run(bits * BENCH_TWI_BIT_CLKS);
+}
+
+static int slaveAcks (void)
+{
+  return ((avr->data[BENCH_DDRB] & (1 << BENCH_PB5)) && \
+          !(avr->data[BENCH_USIDR] & 0x80));
+}
+
+static int twiTransaction (int read, uint8_t *data, int count)
+{
+  int pos;
+  usiEvent(&usiStart, BENCH_USISIF, 8);
+  avr->data[BENCH_USIDR] = (TWI_JOYSTICK_ADDRESS & 0xFE) | (read ? 1 : 0);
+  usiEvent(&usiOverflow, BENCH_USIOIF, 1);
+  if (!slaveAcks())
+    return (0);
+  for (pos = 0; pos < count; pos++)
+  {
+    if (read)
+    {
+      usiEvent(&usiOverflow, BENCH_USIOIF, 8);    /* address/data ACK done */
+      data[pos] = avr->data[BENCH_USIDR];
+      usiEvent(&usiOverflow, BENCH_USIOIF, 1);    /* data shifted out */
+      avr->data[BENCH_USIDR] = (pos < count - 1) ? 0x00 : 0x01;
+    }
+    else
+    {
+      usiEvent(&usiOverflow, BENCH_USIOIF, 8);    /* ACK done */
+      avr->data[BENCH_USIDR] = data[pos];
+      usiEvent(&usiOverflow, BENCH_USIOIF, 1);    /* data shifted in */
+      if (!slaveAcks())
+        return (pos);
+    }
+  }
+  usiEvent(&usiOverflow, BENCH_USIOIF, 1);        /* last ACK/NACK done */
+  avr->data[BENCH_USISR] |= (1 << BENCH_USIPF);
+  return (pos);
+}
+
+
+/* ########################################################################## */
+int main (int argc, char *argv[])
+{
+  elf_firmware_t firmware;
+  int failed = 0;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <elf file> [<name>=<clocks> ...]\n", argv[0]);
+    return (2);
+  }
+  for (int j = 2; j < argc; j++)
+  {
+    char *value = strchr(argv[j], '=');
+    int k;
+    for (k = 0; value && (k < benchCount); k++)
+      if (!strncmp(argv[j], bench[k].name, value - argv[j]) && \
+          (strlen(bench[k].name) == (size_t)(value - argv[j])))
+        break;
+    if (!value || (k >= benchCount))
+    {
+      fprintf(stderr, "unknown budget '%s'\n", argv[j]);
+      return (2);
+    }
+    bench[k].budget = strtoul(value + 1, NULL, 0);
+  }
+
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[1], &firmware))
+  {
+    fprintf(stderr, "can't read %s\n", argv[1]);
+    return (2);
+  }
+  for (int j = 0; j < firmware.symbolcount; j++)
+    if (!strcmp(firmware.symbol[j]->symbol, "rescale_capture"))
+      rescaleAddress = firmware.symbol[j]->addr;
+  avr = avr_make_mcu_by_name("attiny2313");
+  if (!avr)
+  {
+    fprintf(stderr, "simavr lacks the ATtiny2313\n");
+    return (2);
+  }
+  avr_init(avr);
+  avr->frequency = F_CPU;
+  avr_load_firmware(avr, &firmware);
+  avr_register_vector(avr, &usiStart);
+  avr_register_vector(avr, &usiOverflow);
+
+  /* free running: timer ISRs and main loop rescaling */
+  run(BENCH_RUN_CLOCKS);
+  /* readJoyAll, repeated while timers keep running */
+  for (int j = 0; j < 10; j++)
+  {
+    uint8_t command = readJoyAll, data[5];
+    usiClocks = 0;
+    int written = twiTransaction(0, &command, 1);
+    int got = twiTransaction(1, data, sizeof(data));
+    if ((written == 1) && (got == sizeof(data)))
+      record(benchReadJoyAll, usiClocks);
+    run(BENCH_RUN_CLOCKS / 100);
+  }
+  record(benchStack, BENCH_RAMEND - spLowest);
+
+  printf("%-20s %8s %8s %8s\n", "clocks (stack bytes)", "count", "max",
+    "budget");
+  for (int k = 0; k < benchCount; k++)
+  {
+    const char *verdict = "";
+    if (!bench[k].count)
+      verdict = "not measured";
+    else if (bench[k].budget && (bench[k].max > bench[k].budget))
+      verdict = "OVER BUDGET";
+    if (*verdict)
+      failed = 1;
+    printf("%-20s %8lu %8llu %8lu %s\n", bench[k].name, bench[k].count,
+      bench[k].max, bench[k].budget, verdict);
+  }
+  if (responseCount)
+    printf("IRQ_RESPONSE_CLOCKS   : %.1f (compare match to vector)\n",
+      (double) responseSum / responseCount);
+  if (reinitCount)
+    printf("IRQ_REINIT_DELAY_CLKS : %.1f (COMPB vector to timer restart)\n",
+      (double) reinitSum / reinitCount);
+  return (failed);
+}
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,132 @@
+/******************************************************************************\
+*                                                                              *
+* File        : decoder.c (host side)                                          *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : any receiver of the radio link with a C compiler               *
+* Description : Decoder of the delta frames, see decoder.h and telemetry.h.    *
+*               A frame candidate starts with a valid header. If it turns out  *
+*               to be no frame (bad mask or CRC) the search goes on with the   *
+*               byte after its header.                                         *
+*                                                                              *
+\******************************************************************************/
+
+#include "decoder.h"
+#include <string.h>
+
+
+void telemetry_init (struct telemetry_decoder *d)
+{
+  memset(d, 0, sizeof(*d));
+}
+
+
+// size of the frame in buffer, 0 if not known yet, < 0 if no frame
+static int frameSize (struct telemetry_decoder *d)
+{
+  uint8_t header = d->buffer[0];
+  if ((header != TELEMETRY_HEADER(TELEMETRY_KEYFRAME)) && \
+      (header != TELEMETRY_HEADER(TELEMETRY_DELTA)))
+    return (-1);
+  if (d->length < 3)
+    return (0);
+  uint8_t mask = d->buffer[2];
+  if ((mask & ~TELEMETRY_ALL) || \
+      ((header == TELEMETRY_HEADER(TELEMETRY_KEYFRAME)) && (mask != TELEMETRY_ALL)))
+    return (-1);
+  int size = 4;
+  for (int j = 0; j < TELEMETRY_VALUES; j++)
+    if (mask & (1 << j))
+      size++;
+  return (size);
+}
+
+
+// apply a complete frame with valid CRC
+static int takeFrame (struct telemetry_decoder *d)
+{
+  uint8_t sequence = d->buffer[1];
+  uint8_t mask = d->buffer[2];
+  uint8_t *p = &d->buffer[3];
+  if (d->started && (sequence != (uint8_t)(d->sequence + 1)))
+  {
+    d->lost += (uint8_t)(sequence - d->sequence - 1);
+    d->synced = 0;
+  }
+  d->started = 1;
+  d->sequence = sequence;
+  if (d->buffer[0] == TELEMETRY_HEADER(TELEMETRY_KEYFRAME))
+  {
+    memcpy(d->values, p, TELEMETRY_VALUES);
+    d->synced = 1;
+    d->keyframes++;
+  }
+  else if (!d->synced)
+  {
+    d->skipped++;
+    return (0);
+  }
+  else
+    for (int j = 0; j < TELEMETRY_VALUES; j++)
+      if (mask & (1 << j))
+      {
+        if (j == TELEMETRY_BUTTONS)
+          d->values[j] = *p++;
+        else
+          d->values[j] += (int8_t) *p++;
+      }
+  d->frames++;
+  return (1);
+}
+
+
+static void drop (struct telemetry_decoder *d, int count)
+{
+  d->length -= count;
+  memmove(d->buffer, &d->buffer[count], d->length);
+}
+
+
+int telemetry_feed (struct telemetry_decoder *d, uint8_t data)
+{
+  int taken = 0;
+  d->buffer[d->length++] = data;
+  while (d->length)
+  {
+    int size = frameSize(d);
+    if (size < 0)
+    {
+      drop(d, 1);
+      continue;
+    }
+    if ((size == 0) || (d->length < size))
+      break;
+    uint8_t crc = 0;
+    for (int j = 0; j < size - 1; j++)
+      crc = telemetry_crc8(crc, d->buffer[j]);
+    if (crc != d->buffer[size - 1])
+    {
+      d->crcErrors++;
+      drop(d, 1);
+      continue;
+    }
+    taken += takeFrame(d);
+    drop(d, size);
+  }
+  return (taken);
+}
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
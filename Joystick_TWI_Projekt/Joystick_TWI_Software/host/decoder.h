@@ -0,0 +1,55 @@
+/******************************************************************************\
+*                                                                              *
+* File        : decoder.h (host side)                                          *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : any receiver of the radio link with a C compiler               *
+* Description : Decoder of the delta frames described in telemetry.h. Feed it  *
+*               the received bytes one by one, it finds the frames in the      *
+*               stream, rejects corrupted ones by their CRC and keeps the      *
+*               current joystick values.                                       *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include "../../telemetry.h"
+
+struct telemetry_decoder
+{
+  uint8_t buffer[TELEMETRY_MAX_SIZE];
+  int length;                               /* bytes in buffer */
+  int synced;                               /* values valid for deltas */
+  int started;                              /* sequence valid */
+  uint8_t sequence;                         /* of the frame taken last */
+  uint8_t values[TELEMETRY_VALUES];         /* X1, Y1, X2, Y2, pushbuttons */
+  unsigned long frames;                     /* frames taken */
+  unsigned long keyframes;                  /* ... of them keyframes */
+  unsigned long crcErrors;                  /* candidates with bad CRC */
+  unsigned long lost;                       /* gaps in sequence numbers */
+  unsigned long skipped;                    /* deltas without reference */
+};
+
+void telemetry_init (struct telemetry_decoder *d);
+
+// take next received byte, returns the number of frames that updated values
+int telemetry_feed (struct telemetry_decoder *d, uint8_t data);
+
+#endif // #ifndef __DECODER_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,81 @@
+/******************************************************************************\
+*                                                                              *
+* File        : rescale.c (host side)                                          *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host                                                     *
+* Description : Checks the division free rescaling of rescale.h against the    *
+*               division it replaces, for every capture 0..CAPTURE_LIMIT and   *
+*               trim minimum 0..CAPTURE_LIMIT - 1 (the result only depends on  *
+*               their difference) and every factor trim points give, i.e.      *
+*               6 * (max - min) / 240 other than 0 for max and min up to       *
+*               CAPTURE_LIMIT - 1 (see calculate_trim_factor()). The bitwise   *
+*               reciprocal is checked for every factor 1..32767 on its own.    *
+*               Exit code 0 if all match.                                      *
+*                                                                              *
+\******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "joystick_twi.h"
+#include "rescale.h"
+
+
+int main (void)
+{
+  const int32_t span = 6 * (CAPTURE_LIMIT - 1) / \
+    (DESIRED_MAX_READING - DESIRED_MIN_READING + 1);
+  unsigned long checked = 0, errors = 0;
+  for (int32_t factor = 1; factor <= 32767; factor++)
+  {
+    struct rescale_data r;
+    rescale_reciprocal(factor, &r);
+    uint8_t shift = r.shift & ~RESCALE_NEGATIVE;
+    uint32_t expected = ((1UL << (15 + shift)) + factor - 1) / factor;
+    checked++;
+    if ((factor > (1L << shift)) || (shift && (factor <= (1L << (shift - 1)))) \
+      || (r.reciprocal != expected))
+    {
+      if (errors++ < 10)
+        printf("factor %d: reciprocal %u, shift %u (expected %lu)\n",
+          (int)factor, r.reciprocal, shift, (unsigned long)expected);
+    }
+  }
+  for (int32_t factor = -span; factor <= span; factor++)
+  {
+    if (!factor)
+      continue;
+    struct rescale_data r;
+    rescale_reciprocal(factor, &r);
+    /* capture - minimum */
+    for (int32_t d = -(int32_t)(CAPTURE_LIMIT - 1); d <= (int32_t)CAPTURE_LIMIT; d++)
+    {
+      int16_t n = 6 * d;
+      int16_t expected = n / (int16_t)factor;
+      int16_t q = rescale_divide(n, &r);
+      checked++;
+      if (q != expected)
+      {
+        if (errors++ < 10)
+          printf("factor %d, n %d: %d (expected %d)\n", (int)factor, n, q, expected);
+      }
+    }
+  }
+  printf("%lu checked, %lu error(s)\n", checked, errors);
+  return (errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -0,0 +1,1232 @@
+/******************************************************************************\
+*                                                                              *
+* File        : sim.c                                                          *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Target      : Linux host                                                     *
+* Description : Simulated ATtiny2313 surroundings for the unmodified main.c.   *
+*               The firmware's main() is linked in as firmware_main() and its  *
+*               ISRs are plain functions called from here.                     *
+*               Time is counted in CPU clocks. It proceeds whenever the        *
+*               firmware calls sei() (one main loop slice) or polls a busy     *
+*               flag. Due interrupts are served in vector order as long as     *
+*               the I flag is set.                                             *
+*               Modelled are:                                                  *
+*                - timer 1 with compare A/B and input capture, the capture     *
+*                  time follows an RC model of the pot charged at that moment  *
+*                  and of the common capacitor: charge left by too short a     *
+*                  discharge (time constant DISCHARGE_TAU) makes the next      *
+*                  capture come early                                          *
+*                - timer 0 count and overflow (key debouncing)                 *
+*                - EEPROM, contents taken from the EEMEM section, write time   *
+*                - UART with transmit shifter/buffer and two byte receive FIFO *
+*                  the bytes sent also go through the delta frame decoder      *
+*                  (decoder.c), frames found are printed, frames can be lost   *
+*                  or damaged on the way to it                                 *
+*                  (overrun if not read in time)                               *
+*                - an I²C master clocking the USI with 100kHz, including clock *
+*                  stretching while the USI IRQs are blocked                   *
+*                - watchdog deadline, a miss is reported (no reset)            *
+*               The master and the surroundings are scripted, one command per  *
+*               line ('#' starts a comment):                                   *
+*                pot <1..4> <ohms>|open    set pot resistance                  *
+*                noise <clocks>            random capture jitter (+/-)         *
+*                discharge <clocks>        discharge time constant of the      *
+*                                          board (default DISCHARGE_TAU)       *
+*                button <mask>             pressed buttons, bit 0 = J1B1 ...   *
+*                rts on|off                /RTS active (default) or inactive   *
+*                slice <clocks>            main loop cost between two sei()    *
+*                wait <ms>                 let firmware run                    *
+*                write <byte> ... [restart] TWI write transaction, 'restart'   *
+*                                          omits the stop condition, the next  *
+*                                          read begins with a repeated start   *
+*                read <n> [<byte>|-- ...]  TWI read transaction, optionally    *
+*                                          compared to expected bytes, '='     *
+*                                          expects the byte read last at that  *
+*                                          position, '>' a later sequence      *
+*                                          number (1..127 ahead), '>n' one at  *
+*                                          least n ahead,                      *
+*                                          <lo>..<hi> a byte in that range     *
+*                stall [start]             master of the next read stalls      *
+*                                          after its 1st byte (or right after  *
+*                                          the start condition) and leaves the *
+*                                          bus, a start condition while the    *
+*                                          slave holds SDA low is an error     *
+*                uart <byte>[!] ...        bytes received by the UART, one per *
+*                                          frame time, '!' for a framing error *
+*                link lose|corrupt <n>     the next n delta frames sent get    *
+*                                          lost or arrive with a bit flipped   *
+*                link errors <crc> <lost> <skipped>                            *
+*                                          check the counters of the decoder   *
+*                                          (bad CRC, sequence gaps, deltas     *
+*                                          without reference), '--' any        *
+*                link frames <n>|<lo>..<hi> check the frames sent since the    *
+*                                          last check                          *
+*                decoded <byte>|-- ...     check the values the decoder holds  *
+*                pb6 low|high              check level of PB6 (pulled up, e.g. *
+*                                          change line), edges are printed     *
+*                                          while the UART is off               *
+*                sda low|high              check whether the slave holds SDA   *
+*                                          low (bus idle otherwise)            *
+*                stats                     print counters                      *
+*                eeprom [<addr> <byte>|-- ...]                                 *
+*                                          print EEPROM contents, or check the *
+*                                          bytes from addr on                  *
+*                program <addr> <byte> ...                                     *
+*                                          write the EEPROM from addr on, as a *
+*                                          programmer does (e.g. the trim of   *
+*                                          earlier firmware), reset follows    *
+*                reset                     power cycle: firmware, pots and     *
+*                                          counters start anew, the EEPROM     *
+*                                          stays as it is, the script goes on  *
+*               The simulator terminates at the end of the script, exit code   *
+*               is 1 if any read did not match.                                *
+*                                                                              *
+\******************************************************************************/
+
+#define SIM_REG                 /* IO registers are defined here */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "../../project.h"
+#include "../joystick_twi.h"
+#include "decoder.h"
+
+#ifndef F_TWI
+#define F_TWI                   100000UL
+#endif
+#ifndef F_BAUD
+#define F_BAUD                  19200UL
+#endif
+
+#define   SIM_SLICE_CLOCKS      30      /* default main loop cost per sei() */
+#define   SIM_POLL_CLOCKS       4       /* cost of polling a busy flag */
+#define   SIM_VREF              0.5     /* comparator reference / Vcc */
+#define   SIM_EEPROM_WRITE_CLKS (F_CPU / 1000000UL * 3400) /* 3.4ms */
+#define   SIM_TWI_BIT_CLKS      (F_CPU / F_TWI)
+#define   SIM_CLEAR_ON_WRITE    0x100   /* sentinel of TIFR and UDR */
+#define   SIM_RX_FE             0x100   /* receive FIFO: framing error */
+#define   SIM_RX_DOR            0x200   /* receive FIFO: overrun after it */
+#define   SIM_NEVER             (~0ULL)
+#define   SIM_MAX_BYTES         64
+#define   SIM_EXPECT_ANY        -1      /* read: don't care */
+#define   SIM_EXPECT_SAME       -2      /* read: as read last there */
+#define   SIM_EXPECT_LATER      0x20000 /* read: ahead of the one read last by
+                                           this | n, n = 1..127 at least */
+#define   SIM_EXPECT_RANGE      0x10000 /* read: lo | hi << 8 | this */
+
+
+/* ########################################################################## */
+// firmware (main.c, i2c.h)
+int  firmware_main (void);
+void TIMER1_COMPA_vect (void);
+void TIMER1_COMPB_vect (void);
+void TIMER0_OVF_vect (void);
+void USI_START_vect (void);
+void USI_OVERFLOW_vect (void);
+/* not necessarily part of the firmware */
+void TIMER1_CAPT_vect (void) __attribute__((weak));
+void USART_RX_vect (void) __attribute__((weak));
+void USART_UDRE_vect (void) __attribute__((weak));
+void EEPROM_READY_vect (void) __attribute__((weak));
+void WDT_OVERFLOW_vect (void) __attribute__((weak));
+
+extern volatile uint8_t pending, whoIsNext;
+extern uint8_t __start_sim_eemem[], __stop_sim_eemem[];
+#define   SIM_EEPROM_BASE       0x10000000UL /* see makefile */
+
+
+/* ########################################################################## */
+// simulation state
+void sim_advance (unsigned long);
+static unsigned long long simClock;
+static unsigned long simSliceClocks = SIM_SLICE_CLOCKS;
+static int simInIrq;
+static FILE *script;
+static unsigned long long scriptWaitUntil;
+static int scriptErrors;
+static char **simArgs;                      /* for a reset */
+
+static const uint8_t potBit[4] = POT_TABLE;
+static long potClocks[4];                   /* < 0: pot not connected */
+static long noiseClocks;
+static uint8_t charging;                    /* pot bit being charged */
+static uint8_t discharging;                 /* AINM driven low */
+static double capVolts;                     /* capacitor / Vcc */
+static unsigned long long capSince;         /* capVolts valid at this time */
+static double dischargeTau = DISCHARGE_TAU;
+static int captureArmed;
+static uint16_t captureCount;
+
+static uint8_t pinbLevel = 0xFF;
+static uint8_t pindLevel = 0xFF & ~(1 << PD6); /* /RTS active */
+static uint8_t twiLines = (1 << PB7) | (1 << PB5); /* SCL, SDA released */
+static volatile uint8_t pinb, pind;
+
+static unsigned long t0Clocks;
+static volatile uint8_t eecr;
+static unsigned long long eeWriteEnd = SIM_NEVER;
+
+static int rxValid, rxReported;
+static uint16_t rxQueue[SIM_MAX_BYTES];     /* script bytes to come */
+static int rxHead, rxTail;
+static unsigned long long rxNextAt = SIM_NEVER;
+static uint16_t rxFifo[2];                  /* arrived, not yet read */
+static int rxCount;
+static struct telemetry_decoder txDecoder;  /* receiver of the link */
+static struct telemetry_decoder txFramer;   /* finds frames as sent */
+static uint8_t txLink[TELEMETRY_MAX_SIZE * 2]; /* sent, not delivered yet */
+static int txLinkCount;
+static int txLose, txCorrupt;               /* frames to lose or damage */
+static unsigned long txFramesChecked;       /* by "link frames" */
+static int txBufferFull;
+static uint8_t txBuffer;
+static unsigned long long txShiftEnd;
+
+static unsigned long wdtClocks;             /* 0: watchdog off */
+static unsigned long long wdtDeadline = SIM_NEVER;
+
+static struct
+{
+  unsigned long samples;                    /* timer 1 capture/compare A IRQs */
+  unsigned long samplesLost;                /* 'pending' bit still set */
+  unsigned long slices;                     /* main loop slices (sei) */
+  unsigned long twiTransactions;
+  unsigned long twiNacks;
+  unsigned long long twiStretchClocks;
+  unsigned long uartSent;
+  unsigned long uartReceived;
+  unsigned long uartOverruns;
+  unsigned long eepromWrites;
+  unsigned long watchdogResets;
+} stats;
+
+
+/* ########################################################################## */
+// IRQ dispatching - vector order of ATtiny2313 is the priority
+static int usiStartPending, usiOverflowPending;
+static void twiServed (void);
+
+static int irqPending (void)
+{
+  if ((TIMSK & (1 << ICIE1)) && (TIFR & (1 << ICF1)) && TIMER1_CAPT_vect)
+    return 3;
+  if ((TIMSK & (1 << OCIE1A)) && (TIFR & (1 << OCF1A)))
+    return 4;
+  if ((TIMSK & (1 << TOIE0)) && (TIFR & (1 << TOV0)))
+    return 6;
+  if ((UCSRB & (1 << RXCIE)) && rxValid && USART_RX_vect)
+    return 7;
+  if ((UCSRB & (1 << UDRIE)) && !txBufferFull && USART_UDRE_vect)
+    return 8;
+  if ((TIMSK & (1 << OCIE1B)) && (TIFR & (1 << OCF1B)))
+    return 12;
+  if (usiStartPending && (USICR & (1 << USISIE)))
+    return 15;
+  if (usiOverflowPending && (USICR & (1 << USIOIE)))
+    return 16;
+  if ((eecr & (1 << EERIE)) && !(eecr & (1 << EEPE)) && EEPROM_READY_vect)
+    return 17;
+  return 0;
+}
+
+static void uartUpdate (void);
+
+static void serveIrqs (void)
+{
+  int vector;
+  if (simInIrq)
+    return;
+  while ((SREG & (1 << SREG_I)) && (vector = irqPending()))
+  {
+    uint16_t flags;
+    simInIrq = 1;
+    SREG &= ~(1 << SREG_I);
+    /* hardware clears the flag of the vector taken */
+    if (vector == 3)
+      TIFR &= ~(1 << ICF1);
+    else if (vector == 4)
+      TIFR &= ~(1 << OCF1A);
+    else if (vector == 6)
+      TIFR &= ~(1 << TOV0);
+    else if (vector == 12)
+      TIFR &= ~(1 << OCF1B);
+    flags = TIFR & 0xFF;
+    if ((vector == 3) || (vector == 4))
+    { /* end of conversion */
+      stats.samples++;
+      if (pending & (1 << whoIsNext))
+        stats.samplesLost++;
+    }
+    switch (vector)
+    {
+      case 3:
+        TIMER1_CAPT_vect();
+        break;
+      case 4:
+        TIMER1_COMPA_vect();
+        break;
+      case 6:
+        TIMER0_OVF_vect();
+        break;
+      case 7:
+        USART_RX_vect();
+        rxReported = 1;                     /* UDR has been read */
+        break;
+      case 8:
+        USART_UDRE_vect();
+        break;
+      case 12:
+        TIMER1_COMPB_vect();
+        break;
+      case 15:
+        usiStartPending = 0;
+        USI_START_vect();
+        twiServed();
+        break;
+      case 16:
+        usiOverflowPending = 0;
+        USI_OVERFLOW_vect();
+        twiServed();
+        break;
+      case 17:
+        EEPROM_READY_vect();
+        break;
+    }
+    SREG |= (1 << SREG_I);
+    simInIrq = 0;
+    /* write 1 to clear */
+    if (!(TIFR & SIM_CLEAR_ON_WRITE))
+      TIFR = SIM_CLEAR_ON_WRITE | (flags & ~TIFR & 0xFF);
+    uartUpdate();
+  }
+}
+
+
+/* ########################################################################## */
+// timer 1 with pot charging model, a pot charges the capacitor to Vref in
+// potClocks when it starts empty
+static double potTau (int ch)
+{
+  return (potClocks[ch] / -log(1 - SIM_VREF));
+}
+
+static void capacitorUpdate (void)
+{
+  double t = simClock - capSince;
+  capSince = simClock;
+  if (discharging)
+    capVolts *= exp(-t / dischargeTau);
+  else
+    for (int ch = 0; ch < 4; ch++)
+      if ((charging == potBit[ch]) && (potClocks[ch] >= 0))
+        capVolts = 1 - (1 - capVolts) * exp(-t / potTau(ch));
+}
+
+static void potUpdate (void)
+{
+  uint8_t now = POT_PORT & POT_DDR & POT_BITS;
+  uint8_t drain = DDRB & (1 << AINM);
+  if ((now == charging) && (drain == discharging))
+    return;
+  capacitorUpdate();
+  discharging = drain;
+  if (now == charging)
+    return;
+  charging = now;
+  captureArmed = 0;
+  for (int ch = 0; ch < 4; ch++)
+    if ((now == potBit[ch]) && (potClocks[ch] >= 0))
+    {
+      /* time to Vref, shorter if charge is left */
+      long t = 0;
+      if (capVolts < SIM_VREF)
+        t = lround(potTau(ch) * log((1 - capVolts) / (1 - SIM_VREF)));
+      if (noiseClocks)
+        t += (rand() % (2 * noiseClocks + 1)) - noiseClocks;
+      if (TCCR1B & (1 << ICNC1))
+        t += 4;                             /* noise canceler delay */
+      if (t < 1)
+        t = 1;
+      captureCount = TCNT1 + t;
+      captureArmed = 1;
+    }
+}
+
+static int t1Running (void)
+{
+  return ((TCCR1B & 0x07) != 0);
+}
+
+static unsigned long t0Period (void)
+{
+  return (256UL * (((TCCR0B & 0x07) == T0_CLK_256) ? 256 : 64));
+}
+
+static unsigned long t1Distance (uint16_t target)
+{
+  uint16_t d = target - TCNT1;
+  return (d ? d : 0x10000UL);
+}
+
+
+/* ########################################################################## */
+// EEPROM
+static void eepromUpdate (void)
+{
+  if (eecr & (1 << EEPE))
+  {
+    if (eeWriteEnd == SIM_NEVER)
+    { /* firmware just started a write */
+      eeWriteEnd = simClock + SIM_EEPROM_WRITE_CLKS;
+      stats.eepromWrites++;
+    }
+    else if (simClock >= eeWriteEnd)
+    {
+      eecr &= ~(1 << EEPE);
+      eeWriteEnd = SIM_NEVER;
+    }
+  }
+  eecr &= ~((1 << EERE) | (1 << EEMPE));
+}
+
+volatile uint8_t *sim_eecr (void)
+{
+  sim_advance(SIM_POLL_CLOCKS);
+  return (&eecr);
+}
+
+
+/* ########################################################################## */
+// input pins
+volatile uint8_t *sim_pinb (void)
+{
+  sim_advance(SIM_POLL_CLOCKS);
+  pinb = pinbLevel & (twiLines | ~((1 << PB7) | (1 << PB5)));
+  return (&pinb);
+}
+
+volatile uint8_t *sim_pind (void)
+{
+  sim_advance(SIM_POLL_CLOCKS);
+  pind = pindLevel;
+  return (&pind);
+}
+
+
+/* ########################################################################## */
+// UART
+static unsigned long uartByteClocks (void)
+{
+  unsigned long ubrr = ((unsigned long) UBRRH << 8) | UBRRL;
+  return (10 * 16 * (ubrr + 1));
+}
+
+// the link delivers what the framer has done with, a frame as a whole
+static void linkSend (uint8_t data)
+{
+  int frame = telemetry_feed(&txFramer, data);
+  txLink[txLinkCount++] = data;
+  if (txFramer.length && (txLinkCount < (int) sizeof(txLink)))
+    return;                                 /* frame candidate */
+  if (frame && txLose)
+  {
+    txLose--;
+    printf("%12.3fms uart frame %02x lost on the link\n",
+      simClock * 1e3 / F_CPU, txFramer.sequence);
+    txLinkCount = 0;
+    return;
+  }
+  if (frame && txCorrupt)
+  {
+    txCorrupt--;
+    txLink[txLinkCount - 1] ^= 0x01;        /* CRC */
+    printf("%12.3fms uart frame %02x damaged on the link\n",
+      simClock * 1e3 / F_CPU, txFramer.sequence);
+  }
+  for (int j = 0; j < txLinkCount; j++)
+    if (telemetry_feed(&txDecoder, txLink[j]))
+    {
+      printf("%12.3fms uart frame %02x:", simClock * 1e3 / F_CPU,
+        txDecoder.sequence);
+      for (int k = 0; k < TELEMETRY_VALUES; k++)
+        printf(" %02x", txDecoder.values[k]);
+      printf("\n");
+    }
+  txLinkCount = 0;
+}
+
+static void uartUpdate (void)
+{
+  if (!(UDR & SIM_CLEAR_ON_WRITE))
+  { /* firmware wrote a byte to transmit */
+    if (!txBufferFull)
+    {
+      txBuffer = UDR;
+      txBufferFull = 1;
+    }
+    UDR = SIM_CLEAR_ON_WRITE | (rxFifo[0] & 0xFF);
+  }
+  if (txBufferFull && (simClock >= txShiftEnd))
+  {
+    txBufferFull = 0;
+    txShiftEnd = simClock + uartByteClocks();
+    stats.uartSent++;
+    printf("%12.3fms uart: %02x\n", simClock * 1e3 / F_CPU, txBuffer);
+    linkSend(txBuffer);
+  }
+  if (rxValid && rxReported)
+  { /* byte presented before was read */
+    rxReported = 0;
+    rxFifo[0] = rxFifo[1];
+    rxCount--;
+  }
+  if ((rxHead != rxTail) && (simClock >= rxNextAt))
+  { /* stop bit of next byte, lost if the FIFO is full */
+    stats.uartReceived++;
+    if (rxCount < 2)
+      rxFifo[rxCount++] = rxQueue[rxHead];
+    else
+    {
+      rxFifo[1] |= SIM_RX_DOR;
+      stats.uartOverruns++;
+    }
+    rxHead = (rxHead + 1) % SIM_MAX_BYTES;
+    rxNextAt = (rxHead != rxTail) ? rxNextAt + uartByteClocks() : SIM_NEVER;
+  }
+  rxValid = (rxCount > 0);
+  UDR = (UDR & SIM_CLEAR_ON_WRITE) | (rxFifo[0] & 0xFF);
+}
+
+volatile uint8_t *sim_ucsra (void)
+{
+  static volatile uint8_t ucsra;
+  sim_advance(SIM_POLL_CLOCKS);
+  if (!simInIrq && rxValid && (ucsra & (1 << RXC)))
+    rxReported = 1;                         /* RXC seen, assume UDR is read */
+  uartUpdate();
+  ucsra = (txBufferFull ? 0 : (1 << UDRE));
+  if (rxValid)
+  {
+    ucsra |= (1 << RXC);
+    if (rxFifo[0] & SIM_RX_FE)
+      ucsra |= (1 << FE);
+    if (rxFifo[0] & SIM_RX_DOR)
+      ucsra |= (1 << DOR);
+  }
+  return (&ucsra);
+}
+
+
+/* ########################################################################## */
+// USISR: write 1 to clear the flags, the counter bits are taken as written
+static uint16_t usiSeen = SIM_CLEAR_ON_WRITE;
+
+static void usiUpdate (void)
+{
+  if (!(USISR & SIM_CLEAR_ON_WRITE))
+    USISR = SIM_CLEAR_ON_WRITE | (usiSeen & ~USISR & 0xF0) | (USISR & 0x0F);
+  usiSeen = USISR;
+}
+
+static void usiFlag (uint8_t flag)
+{
+  usiUpdate();
+  USISR |= flag;
+  usiSeen = USISR;
+}
+
+
+/* ########################################################################## */
+// I²C master
+enum
+{
+  twiIdle,
+  twiStart,
+  twiAddress,
+  twiAddressAck,
+  twiWriteData,
+  twiWriteAck,
+  twiReadData,
+  twiReadAck,
+  twiStop,
+  twiStalled,
+};
+
+static struct
+{
+  int state;
+  int waiting;                              /* for USI IRQ to be served */
+  int next;                                 /* phase after IRQ served */
+  unsigned long long raisedAt;              /* USI IRQ raised, SCL held low */
+  unsigned long long at;                    /* end of current phase */
+  int read;
+  int restart;                              /* no stop after this one */
+  int stall;                                /* 1: after 1st byte, 2: start */
+  int count;
+  int pos;
+  uint8_t data[SIM_MAX_BYTES];
+  int expect[SIM_MAX_BYTES];                /* or SIM_EXPECT_... */
+  uint8_t previous[SIM_MAX_BYTES];          /* read last at each position */
+  int previousCount;
+} twi = {.state = twiIdle, .at = SIM_NEVER};
+
+static void twiPhase (int state, int bits)
+{
+  twi.state = state;
+  if (twi.waiting)
+  {
+    twi.next = bits;                        /* SCL is held low by the USI */
+    twi.at = SIM_NEVER;
+  }
+  else
+    twi.at = simClock + bits * SIM_TWI_BIT_CLKS;
+}
+
+static void twiServed (void)
+{
+  if (!twi.waiting)
+    return;
+  twi.waiting = 0;
+  twi.at = simClock + twi.next * SIM_TWI_BIT_CLKS;
+  stats.twiStretchClocks += simClock - twi.raisedAt;
+}
+
+static void twiRaiseOverflow (void)
+{
+  usiFlag(1 << USIOIF);
+  if (USICR & (1 << USIOIE))
+  {
+    usiOverflowPending = 1;
+    twi.waiting = 1;
+    twi.raisedAt = simClock;
+  }
+}
+
+static int twiSlaveAcks (void)
+{
+  return ((DDRB & (1 << PB5)) && !(USIDR & 0x80));
+}
+
+static int twiSlaveHoldsSda (void)
+{
+  return (twiSlaveAcks());                  /* SDA low driven by the USI */
+}
+
+static int twiExpected (int j)
+{
+  int seen = (j < twi.previousCount);
+  switch (twi.expect[j])
+  {
+    case SIM_EXPECT_ANY:
+      return (1);
+    case SIM_EXPECT_SAME:
+      return (seen && (twi.data[j] == twi.previous[j]));
+  }
+  if (twi.expect[j] & SIM_EXPECT_LATER)
+  {
+    uint8_t n = twi.expect[j] & 0xFF;
+    return (seen && ((uint8_t)(twi.data[j] - twi.previous[j] - n) < 128 - n));
+  }
+  if (twi.expect[j] & SIM_EXPECT_RANGE)
+    return ((twi.data[j] >= (twi.expect[j] & 0xFF)) && \
+      (twi.data[j] <= ((twi.expect[j] >> 8) & 0xFF)));
+  return (twi.data[j] == twi.expect[j]);
+}
+
+static void twiFinish (void)
+{
+  printf("%12.3fms twi %s:", simClock * 1e3 / F_CPU,
+    twi.read ? "read " : "write");
+  for (int j = 0; j < twi.pos; j++)
+  {
+    printf(" %02x", twi.data[j]);
+    if (twi.read && !twiExpected(j))
+    {
+      if (twi.expect[j] == SIM_EXPECT_SAME)
+        printf("(expected = %02x)", twi.previous[j]);
+      else if (twi.expect[j] & SIM_EXPECT_LATER)
+        printf("(expected >= %02x)",
+          (uint8_t)(twi.previous[j] + (twi.expect[j] & 0xFF)));
+      else if (twi.expect[j] & SIM_EXPECT_RANGE)
+        printf("(expected %02x..%02x)", twi.expect[j] & 0xFF,
+          (twi.expect[j] >> 8) & 0xFF);
+      else
+        printf("(expected %02x)", twi.expect[j]);
+      scriptErrors++;
+    }
+  }
+  if (twi.read)
+  {
+    memcpy(twi.previous, twi.data, twi.pos);
+    if (twi.previousCount < twi.pos)
+      twi.previousCount = twi.pos;
+  }
+  if (twi.stall)
+    printf(" - stalled after %s", twi.pos ? "1st byte" : "start");
+  else if (twi.pos < twi.count)
+  {
+    printf(" - aborted after %d bytes", twi.pos);
+    stats.twiNacks++;
+    if (twi.read)
+      scriptErrors++;
+  }
+  printf("\n");
+  stats.twiTransactions++;
+  twi.stall = 0;
+  twi.state = twiIdle;
+  twi.at = SIM_NEVER;
+}
+
+static void twiStep (void)
+{
+  switch (twi.state)
+  {
+    case twiStart:
+      if (twiSlaveHoldsSda())
+      {
+        printf("%12.3fms twi %s: SDA held low by the slave, bus stuck\n",
+          simClock * 1e3 / F_CPU, twi.read ? "read " : "write");
+        scriptErrors++;
+        stats.twiTransactions++;
+        twi.stall = 0;
+        twi.state = twiIdle;
+        twi.at = SIM_NEVER;
+        break;
+      }
+      /* SDA and SCL low, a stalling master keeps SCL high */
+      twiLines = (twi.stall == 2) ? (1 << PB7) : 0;
+      usiFlag(1 << USISIF);
+      if (USICR & (1 << USISIE))
+      {
+        usiStartPending = 1;
+        twi.waiting = 1;
+        twi.raisedAt = simClock;
+      }
+      if (twi.stall == 2)
+        twiPhase(twiStalled, 1);
+      else
+        twiPhase(twiAddress, 8);
+      break;
+    case twiAddress:
+      twiLines = (1 << PB7) | (1 << PB5);
+      USIDR = (TWI_JOYSTICK_ADDRESS & 0xFE) | (twi.read ? 1 : 0);
+      twiRaiseOverflow();
+      twiPhase(twiAddressAck, 1);
+      break;
+    case twiAddressAck:
+    case twiWriteAck:
+      if (!twiSlaveAcks())
+      {
+        twiFinish();
+        break;
+      }
+      twiRaiseOverflow();
+      if (twi.read)
+        twiPhase(twiReadData, 8);
+      else if (twi.pos < twi.count)
+        twiPhase(twiWriteData, 8);
+      else
+        twiPhase(twiStop, 1);
+      break;
+    case twiWriteData:
+      USIDR = twi.data[twi.pos++];
+      twiRaiseOverflow();
+      twiPhase(twiWriteAck, 1);
+      break;
+    case twiReadData:
+      twi.data[twi.pos++] = (DDRB & (1 << PB5)) ? USIDR : 0xFF;
+      twiRaiseOverflow();
+      twiPhase(twiReadAck, 1);
+      break;
+    case twiReadAck:
+      USIDR = (twi.pos < twi.count) ? 0x00 : 0x01; /* ACK or NACK */
+      twiRaiseOverflow();
+      if (twi.stall && (twi.pos < twi.count))
+        twiPhase(twiStalled, 1);
+      else if (twi.pos < twi.count)
+        twiPhase(twiReadData, 8);
+      else
+        twiPhase(twiStop, 1);
+      break;
+    case twiStop:
+      if (!twi.restart)
+        usiFlag(1 << USIPF);
+      twiFinish();
+      break;
+    case twiStalled:
+      /* master leaves SCL high and releases SDA, a stop if nobody holds it */
+      twiLines = (1 << PB7) | (1 << PB5);
+      if (!twiSlaveHoldsSda())
+        usiFlag(1 << USIPF);
+      twiFinish();
+      break;
+  }
+}
+
+/* ########################################################################## */
+// watchdog
+void sim_wdt_enable (uint8_t period)
+{
+  wdtClocks = (F_CPU / 1000UL * 16) << period; /* 16ms ... 8s */
+  wdtDeadline = simClock + wdtClocks;
+}
+
+void sim_wdt_reset (void)
+{
+  if (wdtClocks)
+    wdtDeadline = simClock + wdtClocks;
+}
+
+static void wdtUpdate (void)
+{
+  if (simClock < wdtDeadline)
+    return;
+  printf("%12.3fms watchdog reset (main loop stuck)\n", simClock * 1e3 / F_CPU);
+  stats.watchdogResets++;
+  scriptErrors++;
+  wdtDeadline = simClock + wdtClocks;
+}
+
+
+static void twiTransaction (int read, int count, int restart)
+{
+  twi.read = read;
+  twi.restart = restart;
+  twi.count = count;
+  twi.pos = 0;
+  twi.waiting = 0;
+  twi.state = twiStart;
+  twi.at = simClock + SIM_TWI_BIT_CLKS;
+}
+
+
+/* ########################################################################## */
+// PB6 open drain (pulled up externally)
+static int pb6Low;
+
+static int pb6IsLow (void)
+{
+  return ((DDRB & (1 << PB6)) && !(PORTB & (1 << PB6)));
+}
+
+static void pb6Update (void)
+{
+  if (pb6IsLow() == pb6Low)
+    return;
+  pb6Low = pb6IsLow();
+  if (!(UCSRB & (1 << TXEN)))
+    printf("%12.3fms pb6 : %s\n", simClock * 1e3 / F_CPU,
+      pb6Low ? "low" : "high");
+}
+
+
+/* ########################################################################## */
+// time keeping
+static void scriptRun (void);
+
+void sim_advance (unsigned long clocks)
+{
+  while (clocks)
+  {
+    /* find next event */
+    unsigned long step = clocks;
+    if (t1Running())
+    {
+      if (captureArmed && (t1Distance(captureCount) < step))
+        step = t1Distance(captureCount);
+      if (t1Distance(OCR1A) < step)
+        step = t1Distance(OCR1A);
+      if (t1Distance(OCR1B) < step)
+        step = t1Distance(OCR1B);
+    }
+    if (TCCR0B & 0x07)
+    {
+      if (t0Period() - t0Clocks < step)
+        step = t0Period() - t0Clocks;
+    }
+    if ((twi.at != SIM_NEVER) && (twi.at > simClock) && \
+        (twi.at - simClock < step))
+      step = twi.at - simClock;
+    /* advance */
+    simClock += step;
+    clocks -= step;
+    if (t1Running())
+    {
+      TCNT1 += step;
+      if (captureArmed && (TCNT1 == captureCount))
+      {
+        captureArmed = 0;
+        ICR1 = captureCount;
+        TIFR |= (1 << ICF1);
+      }
+      if (TCNT1 == OCR1A)
+        TIFR |= (1 << OCF1A);
+      if (TCNT1 == OCR1B)
+        TIFR |= (1 << OCF1B);
+    }
+    if (TCCR0B & 0x07)
+    {
+      t0Clocks += step;
+      if (t0Clocks >= t0Period())
+      {
+        t0Clocks -= t0Period();
+        TIFR |= (1 << TOV0);
+      }
+      TCNT0 = t0Clocks / (t0Period() / 256);
+    }
+    usiUpdate();
+    if (simClock >= twi.at)
+      twiStep();
+    wdtUpdate();
+    eepromUpdate();
+    uartUpdate();
+    serveIrqs();
+    potUpdate();
+    pb6Update();
+  }
+}
+
+void sim_sei (void)
+{
+  SREG |= (1 << SREG_I);
+  if (simInIrq)
+    return;
+  stats.slices++;
+  sim_advance(simSliceClocks);
+  if ((twi.state == twiIdle) && (simClock >= scriptWaitUntil))
+    scriptRun();
+}
+
+
+/* ########################################################################## */
+// script handling
+static void printStats (void)
+{
+  double ms = simClock * 1e3 / F_CPU;
+  double cpu = (double) clock() / CLOCKS_PER_SEC;
+  printf("---- %.3fms simulated, %.3fs host CPU (%.1f x real time)\n",
+    ms, cpu, cpu > 0 ? ms / 1e3 / cpu : 0);
+  printf("samples         : %lu (%.1f per second, %lu not rescaled in time)\n",
+    stats.samples, ms > 0 ? stats.samples * 1e3 / ms : 0, stats.samplesLost);
+  printf("main loop slices: %lu\n", stats.slices);
+  printf("twi transactions: %lu (%lu aborted, %.3fms clock stretching)\n",
+    stats.twiTransactions, stats.twiNacks,
+    stats.twiStretchClocks * 1e3 / F_CPU);
+  printf("uart bytes      : %lu sent, %lu received (%lu overrun)\n",
+    stats.uartSent, stats.uartReceived, stats.uartOverruns);
+  if (txFramer.frames)
+    printf("uart frames     : %lu sent, %lu taken (%lu keyframes), %lu bad CRC, "
+      "%lu lost, %lu skipped\n", txFramer.frames, txDecoder.frames,
+      txDecoder.keyframes, txDecoder.crcErrors, txDecoder.lost,
+      txDecoder.skipped);
+  printf("eeprom writes   : %lu\n", stats.eepromWrites);
+  if (wdtClocks)
+    printf("watchdog resets : %lu\n", stats.watchdogResets);
+}
+
+static void scriptRun (void)
+{
+  char line[256];
+  while (fgets(line, sizeof(line), script))
+  {
+    char *cmd = strtok(line, " \t\r\n");
+    if (!cmd || (cmd[0] == '#'))
+      continue;
+    char *arg = strtok(NULL, " \t\r\n");
+    if (!strcmp(cmd, "pot") && arg)
+    {
+      int ch = atoi(arg) - 1;
+      char *value = strtok(NULL, " \t\r\n");
+      if ((ch >= 0) && (ch < 4) && value)
+        potClocks[ch] = strcmp(value, "open") ? STICK_AT_MIN_RESI + \
+          atol(value) * (STICK_AT_MAX_RESI - STICK_AT_MIN_RESI) / 100000L : -1;
+    }
+    else if (!strcmp(cmd, "noise") && arg)
+      noiseClocks = atol(arg);
+    else if (!strcmp(cmd, "discharge") && arg)
+      dischargeTau = atof(arg);
+    else if (!strcmp(cmd, "button") && arg)
+    {
+      int mask = strtol(arg, NULL, 0);
+      pinbLevel |= BUTTON_BITS1;
+      if (mask & 0x01) pinbLevel &= ~BUTTON1_BIT;
+      if (mask & 0x04) pinbLevel &= ~BUTTON3_BIT;
+      if (mask & 0x08) pinbLevel &= ~BUTTON4_BIT;
+      if (!(UCSRB & (1 << TXEN)))
+      { /* PD6 is /RTS while the UART is in use */
+        pindLevel |= BUTTON_BITS2;
+        if (mask & 0x02) pindLevel &= ~BUTTON2_BIT;
+      }
+    }
+    else if (!strcmp(cmd, "rts") && arg)
+    {
+      if (!strcmp(arg, "on"))
+        pindLevel &= ~(1 << PD6);
+      else
+        pindLevel |= (1 << PD6);
+    }
+    else if (!strcmp(cmd, "slice") && arg)
+      simSliceClocks = atol(arg);
+    else if (!strcmp(cmd, "wait") && arg)
+    {
+      scriptWaitUntil = simClock + \
+        (unsigned long long)(atof(arg) * F_CPU / 1000);
+      return;
+    }
+    else if (!strcmp(cmd, "write"))
+    {
+      int n = 0, restart = 0;
+      for (; arg && (n < SIM_MAX_BYTES); arg = strtok(NULL, " \t\r\n"))
+        if (!strcmp(arg, "restart"))
+          restart = 1;
+        else
+          twi.data[n++] = strtol(arg, NULL, 16);
+      twiTransaction(0, n, restart);
+      return;
+    }
+    else if (!strcmp(cmd, "read") && arg)
+    {
+      int n = atoi(arg);
+      if (n > SIM_MAX_BYTES)
+        n = SIM_MAX_BYTES;
+      for (int j = 0; j < n; j++)
+      {
+        char *e = strtok(NULL, " \t\r\n");
+        if (!e || !strcmp(e, "--"))
+          twi.expect[j] = SIM_EXPECT_ANY;
+        else if (!strcmp(e, "="))
+          twi.expect[j] = SIM_EXPECT_SAME;
+        else if (e[0] == '>')
+          twi.expect[j] = SIM_EXPECT_LATER | (e[1] ? atoi(e + 1) & 0x7F : 1);
+        else
+        {
+          char *end;
+          twi.expect[j] = strtol(e, &end, 16);
+          if (!strncmp(end, "..", 2))
+            twi.expect[j] |= SIM_EXPECT_RANGE | \
+              (strtol(end + 2, NULL, 16) << 8);
+        }
+      }
+      twiTransaction(1, n, 0);
+      return;
+    }
+    else if (!strcmp(cmd, "stall"))
+      twi.stall = (arg && !strcmp(arg, "start")) ? 2 : 1;
+    else if (!strcmp(cmd, "uart"))
+    {
+      for (; arg; arg = strtok(NULL, " \t\r\n"))
+      {
+        char *end;
+        rxQueue[rxTail] = strtol(arg, &end, 16) & 0xFF;
+        if (*end == '!')
+          rxQueue[rxTail] |= SIM_RX_FE;
+        rxTail = (rxTail + 1) % SIM_MAX_BYTES;
+      }
+      if (rxNextAt == SIM_NEVER || rxNextAt < simClock)
+        rxNextAt = simClock + uartByteClocks();
+    }
+    else if (!strcmp(cmd, "link") && arg)
+    {
+      char *value = strtok(NULL, " \t\r\n");
+      if (!strcmp(arg, "lose") && value)
+        txLose = atoi(value);
+      else if (!strcmp(arg, "corrupt") && value)
+        txCorrupt = atoi(value);
+      else if (!strcmp(arg, "frames") && value)
+      {
+        char *end;
+        unsigned long count = txFramer.frames - txFramesChecked;
+        unsigned long lo = strtoul(value, &end, 0), hi = lo;
+        if (!strncmp(end, "..", 2))
+          hi = strtoul(end + 2, NULL, 0);
+        txFramesChecked = txFramer.frames;
+        printf("%12.3fms link frames: %lu", simClock * 1e3 / F_CPU, count);
+        if ((count < lo) || (count > hi))
+        {
+          printf("(expected %s)", value);
+          scriptErrors++;
+        }
+        printf("\n");
+      }
+      else if (!strcmp(arg, "errors"))
+      {
+        unsigned long count[3] = {txDecoder.crcErrors, txDecoder.lost,
+          txDecoder.skipped};
+        printf("%12.3fms link errors:", simClock * 1e3 / F_CPU);
+        for (int j = 0; j < 3; j++, value = strtok(NULL, " \t\r\n"))
+        {
+          printf(" %lu", count[j]);
+          if (value && strcmp(value, "--") && (count[j] != strtoul(value, NULL, 0)))
+          {
+            printf("(expected %s)", value);
+            scriptErrors++;
+          }
+        }
+        printf("\n");
+      }
+    }
+    else if (!strcmp(cmd, "decoded"))
+    {
+      printf("%12.3fms decoded:", simClock * 1e3 / F_CPU);
+      for (int j = 0; j < TELEMETRY_VALUES; j++, arg = strtok(NULL, " \t\r\n"))
+      {
+        printf(" %02x", txDecoder.values[j]);
+        if (arg && strcmp(arg, "--") && (txDecoder.values[j] != strtol(arg, NULL, 16)))
+        {
+          printf("(expected %s)", arg);
+          scriptErrors++;
+        }
+      }
+      printf("\n");
+    }
+    else if (!strcmp(cmd, "pb6") && arg)
+    {
+      if (pb6IsLow() != !strcmp(arg, "low"))
+      {
+        printf("%12.3fms pb6 is %s (expected %s)\n", simClock * 1e3 / F_CPU,
+          pb6IsLow() ? "low" : "high", arg);
+        scriptErrors++;
+      }
+    }
+    else if (!strcmp(cmd, "sda") && arg)
+    {
+      if (twiSlaveHoldsSda() != !strcmp(arg, "low"))
+      {
+        printf("%12.3fms sda is %s (expected %s)\n", simClock * 1e3 / F_CPU,
+          twiSlaveHoldsSda() ? "held low" : "released", arg);
+        scriptErrors++;
+      }
+    }
+    else if (!strcmp(cmd, "stats"))
+      printStats();
+    else if (!strcmp(cmd, "eeprom") && arg)
+    {
+      int address = strtol(arg, NULL, 16) & E2END;
+      printf("%12.3fms eeprom %02x:", simClock * 1e3 / F_CPU, address);
+      for (arg = strtok(NULL, " \t\r\n"); arg && (address <= E2END);
+        arg = strtok(NULL, " \t\r\n"), address++)
+      {
+        printf(" %02x", sim_eeprom[address]);
+        if (strcmp(arg, "--") && (sim_eeprom[address] != strtol(arg, NULL, 16)))
+        {
+          printf("(expected %s)", arg);
+          scriptErrors++;
+        }
+      }
+      printf("\n");
+    }
+    else if (!strcmp(cmd, "program") && arg)
+    {
+      int address = strtol(arg, NULL, 16) & E2END;
+      printf("%12.3fms program %02x:", simClock * 1e3 / F_CPU, address);
+      for (arg = strtok(NULL, " \t\r\n"); arg && (address <= E2END);
+        arg = strtok(NULL, " \t\r\n"), address++)
+      {
+        sim_eeprom[address] = strtol(arg, NULL, 16);
+        printf(" %02x", sim_eeprom[address]);
+      }
+      printf("\n");
+    }
+    else if (!strcmp(cmd, "reset"))
+    { /* run this program again, EEPROM, script position, clock and errors
+         handed over by a file named in the environment */
+      char name[] = "/tmp/simresetXXXXXX", resume[64];
+      int fd = mkstemp(name);
+      if ((fd < 0) || (write(fd, sim_eeprom, sizeof(sim_eeprom)) != sizeof(sim_eeprom)))
+      {
+        perror(name);
+        exit(2);
+      }
+      close(fd);
+      printf("%12.3fms reset\n", simClock * 1e3 / F_CPU);
+      fflush(stdout);
+      snprintf(resume, sizeof(resume), "%ld %llu %d", ftell(script), simClock,
+        scriptErrors);
+      setenv("SIM_RESUME", resume, 1);
+      setenv("SIM_RESUME_EEPROM", name, 1);
+      execl("/proc/self/exe", simArgs[0], simArgs[1], (char*) NULL);
+      perror("reset");
+      exit(2);
+    }
+    else if (!strcmp(cmd, "eeprom"))
+    {
+      for (int j = 0; j <= E2END; j++)
+        printf("%s%02x", (j & 0x0F) ? " " : (j ? "\neeprom: " : "eeprom: "),
+          sim_eeprom[j]);
+      printf("\n");
+    }
+    else
+      fprintf(stderr, "unknown script command '%s'\n", cmd);
+  }
+  printStats();
+  printf("%d error(s)\n", scriptErrors);
+  exit(scriptErrors ? 1 : 0);
+}
+
+
+/* ########################################################################## */
+// start up: reset state of the MCU, program EEPROM, then run firmware
+int main (int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s <script>\n", argv[0]);
+    return (2);
+  }
+  script = fopen(argv[1], "r");
+  if (!script)
+  {
+    perror(argv[1]);
+    return (2);
+  }
+  srand(1);
+  simArgs = argv;
+  memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+  for (uint8_t *p = __start_sim_eemem; p < __stop_sim_eemem; p++)
+    sim_eeprom[(p - (uint8_t*) SIM_EEPROM_BASE) & E2END] = *p;
+  if (getenv("SIM_RESUME") && getenv("SIM_RESUME_EEPROM"))
+  { /* after a reset command */
+    long offset;
+    FILE *saved = fopen(getenv("SIM_RESUME_EEPROM"), "rb");
+    if (!saved || (fread(sim_eeprom, 1, sizeof(sim_eeprom), saved) != sizeof(sim_eeprom)) \
+      || (sscanf(getenv("SIM_RESUME"), "%ld %llu %d", &offset, &simClock,
+        &scriptErrors) != 3))
+    {
+      perror("reset");
+      return (2);
+    }
+    fclose(saved);
+    unlink(getenv("SIM_RESUME_EEPROM"));
+    fseek(script, offset, SEEK_SET);
+    unsetenv("SIM_RESUME");
+    unsetenv("SIM_RESUME_EEPROM");
+  }
+  TIFR = SIM_CLEAR_ON_WRITE;
+  UDR = SIM_CLEAR_ON_WRITE;
+  USISR = SIM_CLEAR_ON_WRITE;
+  MCUSR = (1 << PORF);
+  for (int ch = 0; ch < 4; ch++)
+    potClocks[ch] = (STICK_AT_MIN_RESI + STICK_AT_MAX_RESI) / 2;
+  return (firmware_main());
+}
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
@@ -1,6 +1,6 @@
 /*****************************************************************************\
  *
- * Definitions for IC usage. Attempt to uniquify different hardware schemes
+ * Definitions for I²C usage. Attempt to uniquify different hardware schemes
  * (e.g. ATtiny26 - USI, ATmega8 - TWI) into easy to use SW routines. These
  * routines serve as low level driver with uniquified interface to higher
  * abstraction levels (e.g. communicating to or emulation of PCF8574, 2416).
@@ -14,6 +14,7 @@
  * To avoid useless code overhead some more flags have to be specified some-
  * where in the project file(s):
  * __use_twi_slave__			for slave response only
+ * __use_twi_slave_irq__		for slave response only, interrupt driven
  * __use_twi_single_master__	for single master mode
  * __use_twi_multi_master__		for multi master mode
  *
@@ -100,6 +101,12 @@ void setupTwiBus (char);			// set up ressources used
 char twi_getaddressSlave (char*, char);// check for start condition and receive byte
 char twi_receiveByteSlave (char*);	// receive byte, send ACK
 char twi_sendByteSlave (char);		// send byte, check ACK
+#elif defined __use_twi_slave_irq__
+// ------ slave mode, interrupt driven ------
+void setupTwiBus (char);			// set up ressources used, enable IRQs
+char twi_slaveTransmitHook (char);	// to be supplied by application: byte to send
+void twi_slaveReceiveHook (char, char);// to be supplied by application: byte received
+char twi_slaveSupervise (void);		// give up stalled transfer, reset USI
 #elif defined __use_twi_single_master__
 // ------ single master mode ------
 void setupTwiBus (void);			// set up ressources used
@@ -134,19 +141,63 @@ char releaseTwiBus (void);			// assert stop condition
 #if defined __avrUsi__
 // ----------------------------------------------------------------------------
 // slave mode using USI
+// Optionally the waits for the master are bounded, the application defines:
+//  TWI_SLAVE_TIMER					free running 8 bit counter, e.g. TCNT0
+//  TWI_SLAVE_WAIT_TICKS			its ticks to wait for the master at most,
+//									the bus is reset by setupTwiBus() then
 // ----------------------------------------------------------------------------
-void twi_sendAckSlave (void)
+#ifdef TWI_SLAVE_TIMER
+#define __twiWaitBegin__	unsigned char twiWaitStart = TWI_SLAVE_TIMER
+#define __twiWaitOver__		((unsigned char)(TWI_SLAVE_TIMER - twiWaitStart) > TWI_SLAVE_WAIT_TICKS)
+#else
+#define __twiWaitBegin__
+#define __twiWaitOver__		0
+#endif
+
+void setupTwiBus (char);
+
+// wait for counter overflow, start or stop condition
+char twi_waitUsiSlave (void)
+{
+	__twiWaitBegin__;
+
+	while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0)
+		if (__twiWaitOver__)
+		{
+			setupTwiBus(0);				// master stalled, release bus
+			return (__twiFail__);
+		}
+	return (__twiOk__);
+}
+
+// wait for falling edge SCL
+char twi_waitSclLowSlave (void)
+{
+	__twiWaitBegin__;
+
+	while ((TWIread & (1<<TWIsclBit)) != 0)
+		if (__twiWaitOver__)
+		{
+			setupTwiBus(0);				// master stalled, release bus
+			return (__twiFail__);
+		}
+	return (__twiOk__);
+}
+
+char twi_sendAckSlave (void)
 {
 	USIDR = 0x00;						// prepare for ACK
 	TWIddr |= (1<<TWIsdaBit);			// enable SDA as output to the bus
 	USISR = (1<<USIOIF) | 14;			// release SCL and preset for ACK sending
-	while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0) {}
+	if (twi_waitUsiSlave() != __twiOk__)
+		return (__twiFail__);
 	TWIddr &= ~(1<<TWIsdaBit);			// release SDA
+	return (__twiOk__);
 }
 
 void setupTwiBus (char dummy)
 {
-	// setup does not disrupt any IC transfer!
+	// setup does not disrupt any I²C transfer!
 	USICR = (0b11<<USIWM0) | (0b10<<USICS0) | (0b0<<USICLK);
 /* ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ */
 /* typo in datasheet? 0b10<<USICS0 selects shift on falling edge */
@@ -164,15 +215,18 @@ char twi_getaddressSlave (char *address, char mask)
 	USISR = (1<<USIOIF) | (1<<USIPF);	// clear the counter (otherwise SCL gets blocked later!)
 	if ((USISR & (1<<USISIF)) != 0)
 	{
-		while ((TWIread & (1<<TWIsclBit)) != 0) {}// wait for falling edge SCL
+		if (twi_waitSclLowSlave() != __twiOk__)// wait for falling edge SCL
+			return (__twiFail__);
 		USISR = (1<<USIOIF) | (1<<USISIF) | (1<<USIPF);// clear some flags and also the counter
-		while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0) {}// do until counter rolls over, start or stop condition happens
+		if (twi_waitUsiSlave() != __twiOk__)// do until counter rolls over, start or stop condition happens
+			return (__twiFail__);
 		if ((USISR & ((1<<USISIF) | (1<<USIPF))) == 0)
 		{
 			*address = USIDR;
 			if (adr == (*address & mask))
 			{
-				twi_sendAckSlave();
+				if (twi_sendAckSlave() != __twiOk__)
+					return (__twiFail__);
 				if ((USISR & ((1<<USISIF) | (1<<USIPF))) == 0)
 					return (__twiOk__);// base address match and not aborted
 			}
@@ -184,12 +238,12 @@ char twi_getaddressSlave (char *address, char mask)
 char twi_receiveByteSlave (char *data)
 {
 	USISR = (1<<USIOIF);				// clear counter
-	while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0) {}
+	if (twi_waitUsiSlave() != __twiOk__)
+		return (__twiFail__);			// master stalled
 	if ((USISR & ((1<<USISIF) | (1<<USIPF))) == 0)
 	{
 		*data = USIDR;
-		twi_sendAckSlave();
-		return (__twiOk__);			// data received
+		return (twi_sendAckSlave());	// data received
 	}
 	return (__twiFail__);				// aborted by start/stop condition
 }
@@ -197,15 +251,18 @@ char twi_receiveByteSlave (char *data)
 char twi_sendByteSlave (char data)
 {
 	USIDR = data;						// put data to shifter
-	while ((TWIread & (1<<TWIsclBit)) != 0) {}// wait for falling edge SCL
+	if (twi_waitSclLowSlave() != __twiOk__)// wait for falling edge SCL
+		return (__twiFail__);
 	TWIddr |= (1<<TWIsdaBit);			// enable SDA as output to the bus
 	USISR = (1<<USIOIF);				// clear the counter
-	while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0) {}// do until counter rolls over, start or stop condition
+	if (twi_waitUsiSlave() != __twiOk__)// do until counter rolls over, start or stop condition
+		return (__twiFail__);
 	TWIddr &= ~(1<<TWIsdaBit);			// release SDA
 	if ((USISR & ((1<<USISIF) | (1<<USIPF))) == 0)
 	{
     USISR = (1<<USIOIF) | 14;			// release SCL and preset for ACK checking
-    while ((USISR & ((1<<USIOIF) | (1<<USISIF) | (1<<USIPF))) == 0) {}
+    if (twi_waitUsiSlave() != __twiOk__)
+      return (__twiFail__);
     if ((USISR & ((1<<USISIF) | (1<<USIPF))) == 0)
     {
       if ((USIDR & 0x01) == 0)		// check status
@@ -271,6 +328,207 @@ char twi_sendByteSlave (char data)
 	}
 }
 #endif
+#elif defined __use_twi_slave_irq__
+#if defined __avrUsi__
+// ----------------------------------------------------------------------------
+// slave mode using USI, interrupt driven
+// The start condition IRQ arms the engine, the counter overflow IRQ walks
+// through address check, data transfer and ACK handling. Data is exchanged
+// with the application by the two hooks declared above, both are called in
+// IRQ context and therefore must be short:
+//  twi_slaveTransmitHook (first)	returns the next byte to send, 'first' is
+//									set for the 1st byte after address + R
+//  twi_slaveReceiveHook (data, first)	delivers a received byte, 'first' is
+//									set for the 1st byte after address + W
+// Optionally the application may count bus events by defining these macros:
+//  TWI_SLAVE_ADDRESSED				own address received
+//  TWI_SLAVE_ABORTED				start or stop condition in the middle of a
+//									read (master gave up without NACK)
+//  TWI_SLAVE_READ_DONE				read ended (NACK, start or stop condition,
+//									given up as stalled)
+// Optionally the wait for SCL after a start condition is bounded, the
+// application defines:
+//  TWI_SLAVE_TIMER					free running 8 bit counter, e.g. TCNT0
+//  TWI_SLAVE_WAIT_TICKS			its ticks SCL may stay high after a start
+//									condition, the start is ignored after that
+// A master stalling in the middle of a transfer may leave SDA held low by the
+// slave. twi_slaveSupervise() called periodically (IRQs disabled, e.g. by a
+// timer IRQ) gives up a transfer without bus events for
+// TWI_SLAVE_TIMEOUT_CALLS calls and resets the USI by setupTwiBus().
+// ----------------------------------------------------------------------------
+#include <avr/interrupt.h>
+
+#ifndef TWI_SLAVE_ADDRESS_MASK
+#define TWI_SLAVE_ADDRESS_MASK	0b11111110	/* bits compared to own address */
+#endif
+#ifndef TWI_SLAVE_ADDRESSED
+#define TWI_SLAVE_ADDRESSED		((void) 0)
+#endif
+#ifndef TWI_SLAVE_ABORTED
+#define TWI_SLAVE_ABORTED		((void) 0)
+#endif
+#ifndef TWI_SLAVE_READ_DONE
+#define TWI_SLAVE_READ_DONE		((void) 0)
+#endif
+#ifndef TWI_SLAVE_TIMEOUT_CALLS
+#define TWI_SLAVE_TIMEOUT_CALLS	8		/* calls of twi_slaveSupervise() */
+#endif
+
+#define __usiStartOnly__	(1<<USISIE) | (0<<USIOIE) | (0b10<<USIWM0) | (0b10<<USICS0)
+#define __usiStartAndData__	(1<<USISIE) | (1<<USIOIE) | (0b11<<USIWM0) | (0b10<<USICS0)
+#define __usiClearFlags__	(1<<USIOIF) | (1<<USIPF) | (1<<USIDC)
+
+enum
+{ /* states of USI overflow engine */
+	twiCheckAddress,
+	twiSendData,
+	twiRequestAck,
+	twiCheckAck,
+	twiRequestData,
+	twiGetData,
+	twiIdle,
+};
+
+volatile char twiOwnAddress;
+volatile char twiState;
+volatile char twiFirstByte;
+volatile unsigned char twiSilence;		/* supervision calls without bus event */
+
+void setupTwiBus (char address)
+{
+	// setup does not disrupt any I²C transfer!
+	twiOwnAddress = address & TWI_SLAVE_ADDRESS_MASK;
+	twiState = twiIdle;
+	TWIddr &= ~((1<<TWIsdaBit) | (1<<TWIsclBit));
+	TWIport |= (1<<TWIsdaBit) | (1<<TWIsclBit);
+	TWIddr |= (1<<TWIsclBit);			// enable SCL drive by slave device
+	USICR = __usiStartOnly__;			// wait for start condition
+	USISR = (1<<USISIF) | __usiClearFlags__;
+}
+
+ISR(USI_START_vect)
+{
+	char stalled = 0;
+#ifdef TWI_SLAVE_TIMER
+	unsigned char begin = TWI_SLAVE_TIMER;
+#endif
+
+	if ((twiState == twiSendData) || (twiState == twiRequestAck) || (twiState == twiCheckAck))
+	{
+		TWI_SLAVE_ABORTED;				// read not finished by NACK
+		TWI_SLAVE_READ_DONE;
+	}
+	twiState = twiCheckAddress;
+	twiSilence = 0;
+	TWIddr &= ~(1<<TWIsdaBit);			// release SDA
+	while (((TWIread & (1<<TWIsclBit)) != 0) && ((TWIread & (1<<TWIsdaBit)) == 0))// wait for falling edge SCL (or stop)
+	{
+#ifdef TWI_SLAVE_TIMER
+		if ((unsigned char)(TWI_SLAVE_TIMER - begin) > TWI_SLAVE_WAIT_TICKS)
+		{
+			stalled = ~0;				// master stalled, do not block IRQs
+			break;
+		}
+#endif
+	}
+	if (((TWIread & (1<<TWIsdaBit)) == 0) && !stalled)
+		USICR = __usiStartAndData__;	// start completed, receive address
+	else
+	{
+		twiState = twiIdle;
+		USICR = __usiStartOnly__;		// stop condition followed, ignore
+	}
+	USISR = (1<<USISIF) | __usiClearFlags__;// clear flags and also the counter
+}
+
+ISR(USI_OVERFLOW_vect)
+{
+	char data;
+
+	twiSilence = 0;
+	switch (twiState)
+	{
+		case twiCheckAddress:
+			data = USIDR;
+			if ((data & TWI_SLAVE_ADDRESS_MASK) != twiOwnAddress)
+				break;					// not for us, wait for next start
+			TWI_SLAVE_ADDRESSED;
+			twiFirstByte = ~0;
+			if ((data & __twiRead__) == __twiRead__)
+				twiState = twiSendData;
+			else
+				twiState = twiRequestData;
+			USIDR = 0x00;				// prepare for ACK
+			TWIddr |= (1<<TWIsdaBit);	// enable SDA as output to the bus
+			USISR = __usiClearFlags__ | 14;// release SCL and preset for ACK sending
+			return;
+		case twiCheckAck:
+			if ((USIDR & 0x01) != 0)
+			{
+				TWI_SLAVE_READ_DONE;	// NACK, master finished reading
+				break;
+			}
+			// fall through - ACK, master wants more data
+		case twiSendData:
+			USIDR = twi_slaveTransmitHook(twiFirstByte);// put data to shifter
+			twiFirstByte = 0;
+			twiState = twiRequestAck;
+			TWIddr |= (1<<TWIsdaBit);	// enable SDA as output to the bus
+			USISR = __usiClearFlags__;	// release SCL and clear the counter
+			return;
+		case twiRequestAck:
+			twiState = twiCheckAck;
+			TWIddr &= ~(1<<TWIsdaBit);	// release SDA
+			USIDR = 0x00;
+			USISR = __usiClearFlags__ | 14;// release SCL and preset for ACK checking
+			return;
+		case twiRequestData:
+			twiState = twiGetData;
+			TWIddr &= ~(1<<TWIsdaBit);	// release SDA
+			USISR = __usiClearFlags__;	// release SCL and clear the counter
+			return;
+		case twiGetData:
+			twi_slaveReceiveHook(USIDR, twiFirstByte);
+			twiFirstByte = 0;
+			twiState = twiRequestData;
+			USIDR = 0x00;				// prepare for ACK
+			TWIddr |= (1<<TWIsdaBit);	// enable SDA as output to the bus
+			USISR = __usiClearFlags__ | 14;// release SCL and preset for ACK sending
+			return;
+	}
+	// transfer finished or not addressed: release bus, wait for start condition
+	twiState = twiIdle;
+	TWIddr &= ~(1<<TWIsdaBit);			// release SDA
+	USICR = __usiStartOnly__;
+	USISR = __usiClearFlags__;
+}
+
+char twi_slaveSupervise (void)
+{
+	if (twiState == twiIdle)
+		return (__twiOk__);
+	if ((USISR & (1<<USIPF)) != 0)
+	{ // stop condition ended a write, nothing stalled
+		if ((twiState == twiSendData) || (twiState == twiRequestAck) || (twiState == twiCheckAck))
+		{
+			TWI_SLAVE_ABORTED;			// read not finished by NACK
+			TWI_SLAVE_READ_DONE;
+		}
+		twiState = twiIdle;
+		USICR = __usiStartOnly__;
+		USISR = __usiClearFlags__;
+		return (__twiOk__);
+	}
+	if (++twiSilence < TWI_SLAVE_TIMEOUT_CALLS)
+		return (__twiOk__);
+	if ((twiState == twiSendData) || (twiState == twiRequestAck) || (twiState == twiCheckAck))
+		TWI_SLAVE_READ_DONE;			// read given up as stalled
+	setupTwiBus(twiOwnAddress);			// release SDA and SCL, wait for start
+	return (__twiFail__);
+}
+#elif defined __avrTwi__
+#error: interrupt driven TWI slave not implemented yet, use '__use_twi_slave__'
+#endif
 #elif defined __use_twi_single_master__
 // ----------------------------------------------------------------------------
 // single master prerequisites checking
@@ -296,7 +554,7 @@ void twiDelay (void)
 
 void setupTwiBus (void)
 {
-	// setup does not disrupt any IC transfer!
+	// setup does not disrupt any I²C transfer!
 	USICR = (0b11<<USIWM0) | (0b10<<USICS0) | (0b0<<USICLK);
 	TWIddr &= ~((1<<TWIsdaBit) | (1<<TWIsclBit));
 	TWIport |= (1<<TWIsdaBit) | (1<<TWIsclBit);
@@ -504,7 +762,7 @@ void twiDelay (void)
 
 void setupTwiBus (char dummy)
 {
-	// setup does not disrupt any IC transfer!
+	// setup does not disrupt any I²C transfer!
 	USICR = (0b11<<USIWM0) | (0b10<<USICS0) | (0b0<<USICLK);
 	TWIddr &= ~((1<<TWIsdaBit) | (1<<TWIsclBit));
 	TWIport |= (1<<TWIsdaBit) | (1<<TWIsclBit);
@@ -573,7 +831,7 @@ void softTwiDelay (void)
 
 inline void setupSoftTwiBus (void)
 {
-	// setup does not disrupt any IC transfer!
+	// setup does not disrupt any I²C transfer!
 	softTWIddr &= ~((1<<softTWIsdaBit) | (1<<softTWIsclBit));
 	softTWIport &= ~((1<<softTWIsdaBit) | (1<<softTWIsclBit));
 }
@@ -31,8 +31,28 @@
 
 /* ######## properties ######## */
 #define   SCAN_PERIOD           2000UL  /* us */
+#define   POT_CHANNELS          4       /* pots scanned, first ones of
+                                           POT_TABLE, 1..4 */
+#if ((POT_CHANNELS < 1) || (POT_CHANNELS > 4))
+#error: frame and 'V' bits carry 1..4 pots!
+#endif
+#define   POT_CHANNEL_MASK      ((1 << POT_CHANNELS) - 1) /* 1 per pot */
 #define   CAPTURE_LIMIT         5332UL  /* clocks - also limit of conversion
                                            input, MAXIMUM is 32767 / 6 = 5461! */
+#define   DISCHARGE_CLOCKS      (F_CPU / 1000000UL * SCAN_PERIOD - CAPTURE_LIMIT)
+                                        /* clocks - discharge after capture */
+#define   DISCHARGE_TAU         128U    /* clocks - time constant of the
+                                           discharge path (AINM pin) */
+#define   DISCHARGE_FROM_VREF   (10 * DISCHARGE_TAU)
+                                        /* clocks - adaptive discharge, takes
+                                           even Vcc (overshoot of a low pot)
+                                           below Vcc / 20000, so the next
+                                           capture is off by < 1 clock */
+#define   DISCHARGE_VERIFY_TOL  48      /* clocks - adaptive vs. fixed reading,
+                                           above 2 x capture noise of +/-20 */
+#if (DISCHARGE_FROM_VREF > DISCHARGE_CLOCKS)
+#warning: adaptive discharge longer than fixed discharge!
+#endif
 #define   DESIRED_MAX_READING    247L   /* equivalent to max resistance detected */
 #define   DESIRED_MIN_READING      8L   /* equivalent to min resistance detected */
 #define   ABSOLUTE_MAX_READING   255L   /* e.g. pot not connected */
@@ -40,6 +60,48 @@
 #if (STICK_AT_MAX_RESI >= CAPTURE_LIMIT)
 #warning: STICK_AT_MAX_RESI beyond timeout - will deny proper function!
 #endif
+#define   OVERSAMPLING_SHIFT    1       /* ring of 2^n captures per pot */
+#define   FILTER_SHIFT          2       /* IIR time constant 2^n samples */
+#define   FILTER_FRACTION       (OVERSAMPLING_SHIFT + FILTER_SHIFT)
+                                        /* fractional bits of filter output */
+#define   HIRES_SHIFT           2       /* 8 bit output * 2^n, 2..4 */
+#define   CHANGE_DEADBAND       2       /* LSB - axis move to flag a change */
+#define   TRIM_RECORD_VERSION   1       /* change with struct trim_record */
+#define   RECORDER_SIZE         8       /* power of 2, samples of recorder */
+#define   RECORDER_POST_TRIGGER (RECORDER_SIZE / 2) /* samples after trigger */
+#define   RECORDER_CAPTURE_MASK 0x3FFF  /* capture bits, timeout saturates */
+#define   BUTTON_EVENT_SIZE     4       /* power of 2, up to 8, events held */
+#define   STATS_WINDOW_SHIFT    6       /* noise statistics over 2^n samples
+                                           of a pot, 2..7 */
+#define   STATS_DEVIATION_LIMIT 127     /* clocks - from the reference of the
+                                           window, up to 127, larger ones
+                                           (jumps) count at the limit and
+                                           saturate its variance */
+#define   STATS_SATURATED       0xFFFFFFFFUL /* squares of a window with a
+                                           jump */
+#if ((STATS_WINDOW_SHIFT < 2) || (STATS_WINDOW_SHIFT > 7))
+#error: STATS_WINDOW_SHIFT out of range!
+#endif
+#if (STATS_DEVIATION_LIMIT > 127)
+#error: STATS_DEVIATION_LIMIT out of range!
+#endif
+#define   AUTORANGE_CONFIRM     4       /* samples in a row beyond the range
+                                           to widen it, fewer are outliers */
+#define   AUTORANGE_MIN_SPAN    1000    /* clocks - learned range replaces
+                                           the trim from this span on */
+#define   AUTORANGE_STABLE_MS   5000UL  /* range unchanged before storing */
+#define   AUTORANGE_STABLE_CYCLES (AUTORANGE_STABLE_MS * 1000 / (POT_CHANNELS * SCAN_PERIOD))
+                                        /* scan cycles, at least */
+#define   TWI_START_HOLD_US     128     /* SCL high after a start condition
+                                           (4us by spec), IRQs are blocked
+                                           meanwhile, the start is ignored
+                                           if it takes longer */
+#define   TWI_STALL_MS          30      /* transfer without bus events is
+                                           given up (SMBus: 25..35ms) */
+#define   WATCHDOG_PERIOD       WDTO_120MS /* main loop pass at most */
+#if ((CAPTURE_LIMIT << FILTER_FRACTION) > 65535UL)
+#error: filter output exceeds 16 bits, reduce OVERSAMPLING_SHIFT or FILTER_SHIFT!
+#endif
 
 /* ######## MCU-type selection ######## */
 #ifdef __AVR_ATtiny2313__
@@ -53,6 +115,14 @@
                                 NC_DDR1 |= NC_BITS1
 #define   SET_UNUSED_AS_VCC     NC_PORT1 &= NC_BITS1;\
                                 NC_DDR1 |= NC_BITS1
+/* - Data changed line (spare PB6, open drain, low active) - */
+#define   CHANGE_PORT           PORTB
+#define   CHANGE_DDR            DDRB
+#define   CHANGE_BIT            (1 << 6)
+#define   INIT_CHANGE_LINE      CHANGE_PORT &= ~CHANGE_BIT;\
+                                CHANGE_DDR &= ~CHANGE_BIT
+#define   ASSERT_CHANGE_LINE    CHANGE_DDR |= CHANGE_BIT
+#define   RELEASE_CHANGE_LINE   CHANGE_DDR &= ~CHANGE_BIT
 /* - Joystick pots -------------------- */
 #define   POT_PORT              PORTD
 #define   POT_DDR               DDRD
@@ -69,14 +139,10 @@
                                 POT_DDR |= POT_BITS
 #define   STOP_CHARGING         POT_DDR &= ~POT_BITS; \
                                 POT_PORT &= ~POT_BITS
-#define   CHARGE_POT1           POT_DDR |= POT1_BIT; \
-                                POT_PORT |= POT1_BIT
-#define   CHARGE_POT2           POT_DDR |= POT2_BIT; \
-                                POT_PORT |= POT2_BIT
-#define   CHARGE_POT3           POT_DDR |= POT3_BIT; \
-                                POT_PORT |= POT3_BIT
-#define   CHARGE_POT4           POT_DDR |= POT4_BIT; \
-                                POT_PORT |= POT4_BIT
+#define   POT_TABLE             { POT1_BIT, POT2_BIT, POT3_BIT, POT4_BIT }
+                                        /* scan order = frame order */
+#define   CHARGE_POT(bit)       POT_DDR |= (bit); \
+                                POT_PORT |= (bit)
 /* - Joystick buttons ----------------- */
 #define   BUTTON_INPORT1        PINB
 #define   BUTTON_PORT1          PORTB
@@ -115,9 +181,16 @@
 #define   CAPTURE_OCCURED       (TIFR & (1 << ICF1))
 #define   CLEAR_CAPTURE_FLAG    TIFR = (1 << ICF1)
 #define   POT_TIMEOUT           (CAPTURE_LIMIT*1e6/F_CPU)
+#define   T1_SCAN_COMPARE       ((F_CPU/1e6)*SCAN_PERIOD)-1-IRQ_RESPONSE_CLOCKS-IRQ_REINIT_DELAY_CLKS
 #define   INIT_T1               OCR1A = ((F_CPU/1e6)*POT_TIMEOUT)-1-IRQ_RESPONSE_CLOCKS; \
-                                OCR1B = ((F_CPU/1e6)*SCAN_PERIOD)-1-IRQ_RESPONSE_CLOCKS-IRQ_REINIT_DELAY_CLKS; \
+                                OCR1B = T1_SCAN_COMPARE; \
                                 TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);
+/* discharge of d clocks scheduled relative to end of conversion at t */
+#define   T1_DISCHARGE_COMPARE(t, d) ((t) + (d) - IRQ_RESPONSE_CLOCKS - IRQ_REINIT_DELAY_CLKS)
+/* early end of conversion: capture IRQ ends charging, compare A is timeout */
+#define   ENABLE_END_OF_CONV_IRQS  TIFR = (1 << ICF1) | (1 << OCF1A); \
+                                   TIMSK |= (1 << ICIE1) | (1 << OCIE1A)
+#define   DISABLE_END_OF_CONV_IRQS TIMSK &= ~((1 << ICIE1) | (1 << OCIE1A))
 #define   START_T1_OPERATION    TCCR1B = T1_CAPTURE_NO_NOISE | T1_CAPTURE_NEGEDGE | T1_FULL_CLK
 #define   STOP_T1_OPERATION     TCCR1B = T1_CAPTURE_NO_NOISE | T1_CAPTURE_NEGEDGE | T1_STOP
 #define   CLEAR_T1_COUNT_REG    TCNT1 = 0
@@ -128,6 +201,8 @@
 #define   T0_MODE_REG_B         TCCR0B
 #define   INIT_T0               TIMSK |= (1 << TOIE0)
 #define   START_T0_OPERATION    TCCR0B = T0_CLK_64
+#define   T0_TICK_US            (64UL * 256 * 1000000UL / F_CPU) /* overflow */
+#define   T0_COUNT_US           (64UL * 1000000UL / F_CPU) /* count */
 #if (F_CPU != 4000000UL)
 #warning: key debouncing rate needs readjustment!!!
 #endif
@@ -143,7 +218,7 @@
 #define   TWIADDR_BITS          (TWIA0_BIT | TWIA1_BIT)
 #define   INIT_TWIADDR_PORTS    TWIADDR_DDR &= ~TWIADDR_BITS;\
                                 TWIADDR_PORT |= TWIADDR_BITS
-#end of __AVR_ATtiny2313__
+// end of __AVR_ATtiny2313__
 /* - Interrupts ----------------------- */
 #define   IRQ_RESPONSE_CLOCKS   8       /* average - measured with debugger */
 #define   IRQ_REINIT_DELAY_CLKS 27      /* average - measured with debugger */
@@ -153,12 +228,15 @@
 #endif // ifdef __AVR_ATtiny2313__
 
 /* ######## interface to key debouncing routines of P. Dannegger ######## */
-#define   KEY_DDR1              BUTTON_DDR
-#define   KEY_PORT1             BUTTON_PORT
-#define   KEY_PIN1              BUTTON_INPORT
-#define   KEY_DDR2              BUTTON_DDR
-#define   KEY_PORT2             BUTTON_PORT
-#define   KEY_PIN2              BUTTON_INPORT
+#define   KEY_DDR1              BUTTON_DDR1
+#define   KEY_PORT1             BUTTON_PORT1
+#define   KEY_PIN1              BUTTON_INPORT1
+#define   KEY_DDR2              BUTTON_DDR2
+#define   KEY_PORT2             BUTTON_PORT2
+#define   KEY_PIN2              BUTTON_INPORT2
+/* buttons are spread over 2 ports but do not share any bit position */
+#define   KEY_PIN               ((KEY_PIN1 & BUTTON_BITS1) | (KEY_PIN2 & BUTTON_BITS2))
+#define   BUTTON_MASK           (BUTTON_BITS1 | BUTTON_BITS2)
 
 #endif // #ifndef __JOYSTICK_TWI_H__
 
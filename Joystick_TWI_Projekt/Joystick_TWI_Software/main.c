@@ -4,7 +4,7 @@
 * Project     : Remote Control - Joystick_TWI                                  *
 * Author      : R. Trapp                                                       *
 * Initial date: 21 May  2012                                                   *
-7.Nov.2013: Die mu noch auf den neuen Schaltplan angepat werden!
+7.Nov.2013: Die muß noch auf den neuen Schaltplan angepaßt werden!
 * Release rev.:                                                                *
 * Copyright   : (c) 2012 H.A.R.R.Y.                                            *
 * Credits     : Peter Dannegger, danni@specs.de - key debouncing               *
@@ -12,7 +12,7 @@
 * License     :                                                                *
 * Target      : ATtiny2313                                                     *
 * Description : Serve analog joystick (aka PC-joystick) and allow read out via *
-*               IC bus. Device acts as IC slave. Output is scaled to 8..247. *
+*               I²C bus. Device acts as I²C slave. Output is scaled to 8..247. *
 *               Joystick nominal values are 0..100kOhm. Tolerances apply to    *
 *               this so each pot needs individual trim setting to calculate    *
 *               final result. First experiments show readouts are stable so a  *
@@ -26,7 +26,19 @@
 *                Joystick 2 - Y (= Pot 4)                                      *
 *                Pushbuttons: MSB                                    LSB       *
 *                             V2Y, V2X, V1Y, V1X, J2B2, J2B1, J1B2, J1B1       *
+*                Frame sequence number                                         *
 *                                                                              *
+*               All values read are taken from the same scan cycle. A frame    *
+*               is published when all four pots are done and gets the next     *
+*               sequence number, so the master can skip frames already seen.   *
+*               A burst reads the frame that was published when it started:    *
+*               publishing waits until the burst is done, or with the frame    *
+*               double buffered, until it is done with the back frame.         *
+*               All data is read through a flat register map (see project.h):  *
+*               the first byte written sets the pointer, reads increment it.   *
+*               Write pointer and read with repeated start to fetch any span   *
+*               of frame, raw captures, trim settings and status in one bus    *
+*               transaction.                                                   *
 *               The 'V' bits indicate INVALID pot reading (e.g. not connected) *
 *               when set!                                                      *
 *                                                                              *
@@ -36,6 +48,9 @@
 *               to perfectly meet the constraints for the next conversion.     *
 *               If maximum pot resistance is exceeded - too high value or even *
 *               no pot - the invalid idication shall be given.                 *
+*               The pots are charged by a table of their port bits. Only the   *
+*               first POT_CHANNELS are scanned (e.g. 2 for a single stick, the *
+*               cycle gets shorter), the others read as not connected.         *
 *               Timer 1 controls digitizing by 2 interrupt routines. One of    *
 *               them checks for timeout (and thus maximum allowed resistance). *
 *               If timeout did not occur the value is taken as a valid sample. *
@@ -43,9 +58,79 @@
 *               routine handles conversion start on the next channel.          *
 *               After sampling a raw value the main loop schedules its conver- *
 *               sion into the desired output value range.                      *
-*               IC is handled if nothing else needs to be done. To speed up   *
-*               TWI response its service routines should be changed to IRQ-    *
-*               usage later on.                                                *
+*               Optionally the capture interrupt ends the conversion as soon   *
+*               as the comparator trips. Discharging starts at once and the    *
+*               next pot is due DISCHARGE_CLOCKS after the capture, so the     *
+*               time per pot follows its resistance. Compare A then only       *
+*               serves as timeout.                                             *
+*               With early end of conversion the capacitor stops charging at   *
+*               Vref (plus what the capture IRQ response adds), a timeout      *
+*               leaves it below. Optionally the discharge phase is then sized  *
+*               for that (DISCHARGE_FROM_VREF) instead of the rest of the 2ms. *
+*               It does not depend on the sample: without early end of         *
+*               conversion a low resistance charges the capacitor close to Vcc *
+*               until the timeout, so the fixed discharge stays.               *
+*               Optional oversampling keeps the last captures of each pot in a *
+*               ring buffer. Their sum (moving average, one per capture so the *
+*               output rate stays) runs through a first order IIR filter. The  *
+*               filter output has fractional bits and is rescaled to a high    *
+*               resolution reading, the 8 bit output is derived from that.     *
+*               Without UART the spare PB6 optionally signals new data to the  *
+*               master: it is pulled low when a frame is published that moved  *
+*               an axis beyond a deadband or changed a button compared to the  *
+*               frame read last. Reading the frame releases it, so the master  *
+*               reads on events only.                                          *
+*               I²C is handled by the USI interrupts in the background. The    *
+*               USI engine fetches each byte to send from a hook, received     *
+*               commands are taken over by another hook. Calibration commands  *
+*               touch the EEPROM and thus are deferred to the main loop.       *
+*               The EEPROM is written in the background by the EE_READY        *
+*               interrupt, it walks the trims to be stored one byte per        *
+*               interrupt, bytes already equal are skipped.                    *
+*               Optionally trim settings are kept as records with version,     *
+*               sequence number and CRC in slots behind the trim table. Each   *
+*               store goes to the next slot, so recalibrating wears the cells  *
+*               evenly. The version byte is written last, so boot takes the    *
+*               newest complete record, a torn write just leaves the one       *
+*               before as newest. Without any the trim table applies, a unit   *
+*               keeps its calibration when records are switched on.            *
+*               The conversion takes minimum and factor of each pot from a RAM *
+*               copy, loaded at boot and whenever a store is complete, so it   *
+*               never waits for the EEPROM. A store takes the trims in use     *
+*               with the calibrated values patched in, they take effect once   *
+*               written completely.                                            *
+*               Instead of teaching the corners the range of each pot can be   *
+*               learned from its captures: it widens when several samples in a *
+*               row lie beyond it, then trim and factor follow. Once the range *
+*               stays unchanged for some seconds it is stored. A pot reading   *
+*               open, e.g. while swapping the joystick, learns from scratch.   *
+*               For noise and RC timing checks an optional recorder keeps the  *
+*               latest raw captures with pot index and timer 0 stamp in a      *
+*               ring. The master arms it, triggers it (it stops half a ring    *
+*               later) and reads the samples in one burst.                     *
+*               Optional counters show the firmware under bus load: main loop  *
+*               passes per scan cycle, TWI transactions, timeouts and how late *
+*               the scan IRQ came at worst (IRQs disabled or other IRQs busy), *
+*               for RAM they need the UART off. They live in a diagnostics     *
+*               block of the register map beyond the debugging commands, the   *
+*               dropped samples next to the UART error counters.               *
+*                                                                              *
+*               Optional noise statistics keep mean, variance, minimum and     *
+*               maximum of the captures of each pot over a window, the pots    *
+*               take turns. Sums of deviations from the mean of the window     *
+*               before avoid divisions and long numbers. The results follow    *
+*               the counters in the diagnostics block.                         *
+*                                                                              *
+*               No wait for the I²C master is unbounded: the start condition   *
+*               IRQ waits for SCL at most TWI_START_HOLD_US, a transfer        *
+*               without bus events for TWI_STALL_MS is given up by the timer 0 *
+*               IRQ and the USI set up anew, which releases SDA. Optionally    *
+*               the watchdog resets the MCU if a main loop pass hangs.         *
+*                                                                              *
+*               Optionally the debounced press and release edges of the        *
+*               buttons are queued with a time stamp, so the master may poll   *
+*               at a relaxed rate and still sees every tap. With UART a press  *
+*               shows in the next frame sent.                                  *
 *                                                                              *
 *               Debouncing the pushbuttons is done by a timer 0 interrupt      *
 *               service.                                                       *
@@ -58,18 +143,178 @@
 *               packet there are roughly 8 to 10 messages exchanged per second.*
 *               If no battery status is received the transmission is repeated  *
 *               after a certain timeout.                                       *
+*               Optionally a frame is sent as soon as it differs from the one  *
+*               sent last instead, rate limited and with a heartbeat. Battery  *
+*               messages then only update the LED.                             *
+*               Also optional is a compact frame format with CRC (see          *
+*               telemetry.h) sending only values that changed since the frame  *
+*               before, a decoder for the receiving side is in host/decoder.c. *
+*               Transmission is done by the UDRE interrupt from a ring buffer, *
+*               an inactive /RTS holds back the UART but never the main loop.  *
+*               Reception is done by the RX interrupt into another ring, the   *
+*               main loop parses whatever has arrived. Lost (overrun) and      *
+*               damaged (framing error) bytes are counted.                     *
 *                                                                              *
 \******************************************************************************/
 
-#define _ALSO_USE_UART_         /* define this for temporary UART support,
-                                   will eat up 206 FLASH bytes, 1 RAM byte */
+//#define _ALSO_USE_UART_     // define this for temporary UART support,
+                                // will eat up some 800 FLASH bytes (the
+                                // default build leaves less, switch off
+                                // others then), 21 RAM bytes
+//#define _SEND_ON_CHANGE_      // define this (needs _ALSO_USE_UART_) to send
+                                // a frame as soon as it differs from the one
+                                // sent last, at most every TELEMETRY_MIN_MS,
+                                // at least every TELEMETRY_HEARTBEAT_MS,
+                                // costs 6 RAM bytes (88 in all)
+//#define _DELTA_FRAMES_        // define this (needs _ALSO_USE_UART_) to send
+                                // the versioned frames of telemetry.h (only
+                                // values changed, sequence number, CRC-8,
+                                // keyframe every TELEMETRY_KEY_PERIOD frames)
+                                // instead of 'J' ... ~'J', 14 RAM bytes
+//#define _DIVIDING_RESCALING_  // define this to rescale captures by
+                                // dividing by the factor instead of multiply
+                                // and shift (see rescale.h), saves 4 RAM
+                                // bytes
+//#define _VERIFY_RESCALING_    // define this (not with _DIVIDING_RESCALING_)
+                                // to check the division free rescaling
+                                // against true division, any mismatch sets
+                                // the 'V' bit of the pot
+//#define _EARLY_END_OF_CONVERSION_ // define this to end charging by the
+                                // capture IRQ, the next pot then follows
+                                // after discharging instead of every 2ms
+//#define _ADAPTIVE_DISCHARGE_  // define this (needs _EARLY_END_OF_CONVERSION_)
+                                // to discharge for DISCHARGE_FROM_VREF only
+                                // instead of the rest of the 2ms
+//#define _VERIFY_DISCHARGE_    // define this (needs _ADAPTIVE_DISCHARGE_)
+                                // to alternate fixed and adaptive discharge
+                                // every scan cycle, adaptive readings off by
+                                // more than DISCHARGE_VERIFY_TOL set the 'V'
+                                // bit of the pot until one passes again,
+                                // costs 12 RAM bytes
+//#define _OVERSAMPLING_        // define this to filter the captures before
+                                // rescaling (moving average over a ring of
+                                // 2^OVERSAMPLING_SHIFT samples and IIR), the
+                                // 8 bit output is derived from a high
+                                // resolution one read by readJoyAllFine,
+                                // costs 34 RAM bytes (OVERSAMPLING_SHIFT 1),
+                                // needs _ALSO_USE_UART_ off (95 RAM bytes in
+                                // all, 116 with UART leave too little stack)
+//#define _CHANGE_NOTIFICATION_ // define this (needs _ALSO_USE_UART_ off) to
+                                // pull the spare PB6 low when a published
+                                // frame differs from the one read last (axis
+                                // by more than CHANGE_DEADBAND or buttons),
+                                // reading the frame releases it, costs 6 RAM
+                                // bytes (67 in all)
+//#define _AUTO_RANGING_        // define this to learn the range of each pot
+                                // from its captures (outliers rejected) and
+                                // rescale by it, stored when stable for
+                                // AUTORANGE_STABLE_MS, an open pot (e.g. the
+                                // joystick swapped) or setJoyAutoRange starts
+                                // learning anew, costs 32 RAM bytes, needs
+                                // _ALSO_USE_UART_ off (93 RAM bytes in all,
+                                // 114 with UART leave too little stack)
+//#define _CAPTURE_RECORDER_    // define this to record successive raw
+                                // captures with pot index and time stamp,
+                                // armed, triggered and read out by TWI (see
+                                // regJoyRecorder), costs 30 RAM bytes, needs
+                                // _ALSO_USE_UART_ off (91 RAM bytes in all,
+                                // 112 with UART leave too little stack)
+//#define _PERF_COUNTERS_       // define this to count main loop passes, TWI
+                                // transactions, timeouts, dropped samples
+                                // and the worst scan IRQ latency, read and
+                                // cleared by TWI (see regJoyCounters), the
+                                // UART counters stay 0, costs 25 RAM bytes,
+                                // needs _ALSO_USE_UART_ off (86 RAM bytes in
+                                // all, 107 with UART leave too little stack)
+//#define _NOISE_STATS_         // define this to keep mean, variance, min
+                                // and max of the captures of each pot over
+                                // windows of 2^STATS_WINDOW_SHIFT samples
+                                // (pots take turns), read by TWI (see
+                                // regJoyNoiseStats), costs 34 RAM bytes,
+                                // needs _ALSO_USE_UART_ off (95 RAM bytes in
+                                // all, 116 with UART leave too little stack)
+//#define _TRIM_RECORDS_        // define this to keep the trim as records
+                                // with version, sequence number and CRC-8 in
+                                // slots behind the trim table, each store
+                                // goes to the next slot (wear leveling, a
+                                // torn write leaves the record before),
+                                // costs 3 RAM bytes
+//#define _WATCHDOG_            // define this to reset the MCU when a main
+                                // loop pass takes longer than
+                                // WATCHDOG_PERIOD, a reset by the watchdog
+                                // is flagged in regJoyStatus, 1 RAM byte
+//#define _BUTTON_EVENTS_       // define this to queue debounced press and
+                                // release edges with a time stamp, read by
+                                // TWI (see regJoyButtonEvents), with UART a
+                                // press shows in the next frame sent even if
+                                // released meanwhile, costs 13 RAM bytes
+                                // (74 in all, 14 and 96 with UART)
+//#define _DOUBLE_BUFFERED_FRAME_ // define this to publish a frame into a
+                                // back buffer while a TWI burst still reads
+                                // the front one instead of waiting for the
+                                // burst to end, costs 7 RAM bytes
 
 #include "../project.h"         /* contains all public definitions (also TWI) */
+#include "../telemetry.h"       /* radio link frame format */
 #include "joystick_twi.h"       /* contains private definitions */
-#define __use_twi_slave__       /* select TWI support */
+#ifdef _PERF_COUNTERS_
+void count_twi (uint8_t aborted);
+#define TWI_SLAVE_ADDRESSED     count_twi(0)
+#define TWI_SLAVE_ABORTED       count_twi(1)
+#endif // ifdef _PERF_COUNTERS_
+extern volatile uint8_t twiFrame;       /* declared below */
+#define NO_FRAME                0xFF
+#define TWI_SLAVE_READ_DONE     twiFrame = NO_FRAME /* publishing goes on */
+#define TWI_SLAVE_TIMER         TCNT0   /* bounded waits, see i2c.h */
+#define TWI_SLAVE_WAIT_TICKS    (TWI_START_HOLD_US / T0_COUNT_US)
+#define TWI_SLAVE_TIMEOUT_CALLS ((TWI_STALL_MS * 1000UL + T0_TICK_US - 1) / T0_TICK_US)
+#define __use_twi_slave_irq__   /* select TWI support */
 #include "i2c.h"                /* TWI service */
 #include <avr/interrupt.h>      /* IRQ definitions */
 #include <avr/eeprom.h>         /* EEPROM support */
+#include <avr/pgmspace.h>       /* channel table */
+#include <stddef.h>             /* offsetof(), trim record patches */
+#ifndef _DIVIDING_RESCALING_
+#define _RECIPROCAL_RESCALING_
+#include "rescale.h"            /* division free rescaling */
+#endif // ifndef _DIVIDING_RESCALING_
+#ifdef _WATCHDOG_
+#include <avr/wdt.h>            /* main loop supervision */
+#endif // ifdef _WATCHDOG_
+
+#if defined _SEND_ON_CHANGE_ && !defined _ALSO_USE_UART_
+#error: send on change needs _ALSO_USE_UART_!
+#endif
+#if defined _DELTA_FRAMES_ && !defined _ALSO_USE_UART_
+#error: delta frames need _ALSO_USE_UART_!
+#endif
+#if defined _CHANGE_NOTIFICATION_ && defined _ALSO_USE_UART_
+#error: change notification uses PB6, which is the battery LED with UART!
+#endif
+#if defined _VERIFY_RESCALING_ && defined _DIVIDING_RESCALING_
+#error: verify rescaling checks the division free one, not _DIVIDING_RESCALING_!
+#endif
+#if defined _OVERSAMPLING_ && defined _ALSO_USE_UART_
+#error: oversampling and UART leave too little RAM for the stack!
+#endif
+#if defined _AUTO_RANGING_ && defined _ALSO_USE_UART_
+#error: auto ranging and UART leave too little RAM for the stack!
+#endif
+#if defined _CAPTURE_RECORDER_ && defined _ALSO_USE_UART_
+#error: capture recorder and UART leave too little RAM for the stack!
+#endif
+#if defined _NOISE_STATS_ && defined _ALSO_USE_UART_
+#error: noise statistics and UART leave too little RAM for the stack!
+#endif
+#if defined _PERF_COUNTERS_ && defined _ALSO_USE_UART_
+#error: performance counters and UART leave too little RAM for the stack!
+#endif
+#if defined _ADAPTIVE_DISCHARGE_ && !defined _EARLY_END_OF_CONVERSION_
+#error: adaptive discharge needs _EARLY_END_OF_CONVERSION_ to stop at Vref!
+#endif
+#if defined _VERIFY_DISCHARGE_ && !defined _ADAPTIVE_DISCHARGE_
+#error: verify discharge needs _ADAPTIVE_DISCHARGE_ to verify!
+#endif
 
 #define TWI_BASE_address         TWI_JOYSTICK_ADDRESS
 enum
@@ -81,7 +326,14 @@ enum
   JOYPBS_INDEX,
   /* ---- insert additional parameters above this line! ----*/
   RESULT_SIZE,
+  FRAME_SEQ_INDEX = RESULT_SIZE, /* frame = result + sequence number */
+  FRAME_SIZE,
 };
+#ifdef _DOUBLE_BUFFERED_FRAME_
+#define FRAME_BUFFERS           2
+#else
+#define FRAME_BUFFERS           1
+#endif // ifdef _DOUBLE_BUFFERED_FRAME_
 
 
 struct trim_data {
@@ -91,28 +343,210 @@ struct trim_data {
 };
 
 
+#ifdef _OVERSAMPLING_
+struct filter_data {
+  uint16_t ring[1 << OVERSAMPLING_SHIFT]; /* last captures */
+  uint16_t accu;       /* IIR output, FILTER_FRACTION fractional bits */
+};
+#endif // ifdef _OVERSAMPLING_
+
+
+#ifdef _AUTO_RANGING_
+struct autorange_data {
+  uint16_t min;        /* learned range, raw captures */
+  uint16_t max;
+  uint16_t candidate;  /* least excess of the samples beyond the range */
+  int8_t   confirm;    /* samples in a row above (> 0) / below (< 0) */
+};
+#endif // ifdef _AUTO_RANGING_
+
+
+#ifdef _PERF_COUNTERS_
+struct perf_counters { /* order of regJoyCounters */
+  uint16_t loops;      /* main loop passes in the last scan cycle */
+  uint16_t loopsMin;   /* fewest passes in a scan cycle */
+  uint16_t twiTransactions; /* addressed to us */
+  uint16_t twiAborted; /* read broken off by start or stop, or stalled */
+  uint16_t timeouts[RESULT_SIZE-1]; /* captures without comparator trip */
+  uint16_t uartSent;   /* frames queued for the UART, 0 (UART off) */
+  uint16_t uartReceived; /* battery messages */
+  uint16_t irqLatencyMax; /* clocks the compare B IRQ came late */
+};
+#endif // ifdef _PERF_COUNTERS_
+
+
+#ifdef _NOISE_STATS_
+struct stats_data {    /* order of regJoyNoiseStats */
+  uint16_t mean;       /* 1/4 clocks */
+  uint16_t variance;   /* 1/16 clocks^2, saturating */
+  uint8_t  below;      /* clocks from mean to min */
+  uint8_t  above;      /* clocks from mean to max */
+};
+#endif // ifdef _NOISE_STATS_
+
+
+struct trim_cache {    /* of the trim in use, all the conversion needs */
+  int16_t  min_resi;
+#if !defined _RECIPROCAL_RESCALING_ || defined _VERIFY_RESCALING_
+  int16_t  factor;
+#endif
+#ifdef _RECIPROCAL_RESCALING_
+  struct rescale_data rescale; /* derived from factor */
+#endif // ifdef _RECIPROCAL_RESCALING_
+};
+
+
+#ifdef _TRIM_RECORDS_
+struct trim_record {
+  uint8_t  version;    /* TRIM_RECORD_VERSION, else slot is not valid */
+  uint8_t  sequence;   /* newest record has the highest (modulo 256) */
+  struct trim_data trim[RESULT_SIZE-1];
+  uint8_t  crc;        /* CRC-8 of all bytes before */
+};
+#endif // ifdef _TRIM_RECORDS_
+
+
 /* ########################################################################## */
-// this data is put into EEPROM (or at least a preparatory EEPROM-hex-file is
-// generated) by default
-EEMEM struct trim_data joyTrim[RESULT_SIZE-1] =
-{
-  {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 1 = Joy 1 X */
-  {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 2 = Joy 1 Y */
-  {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 3 = Joy 2 X */
-  {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 4 = Joy 2 Y */
+// EEPROM: the trim table at address 0 as with firmware before, updated in
+// place; with records it stays as it is, so a unit keeps its calibration
+// across the update (the .eep file holds the defaults there), the record
+// slots fill the rest and are left empty
+#define NO_PATCH        0x80      /* far from any offset into the trims */
+#define TRIM_OFFSET(index, field) \
+  ((index) * sizeof(struct trim_data) + offsetof(struct trim_data, field))
+#if defined _TRIM_RECORDS_ || defined _AUTO_RANGING_
+#define STORE_ALL_TRIMS           /* else a store just patches the table */
+#endif
+#ifdef _TRIM_RECORDS_
+#define TRIM_SLOTS      ((E2END + 1 - sizeof(struct trim_data) * (RESULT_SIZE-1)) \
+                          / sizeof(struct trim_record))
+#define NO_SLOT         0xFF      /* no valid record, next one goes to slot 0 */
+#endif // ifdef _TRIM_RECORDS_
+struct trim_eeprom {
+  struct trim_data joyTrim[RESULT_SIZE-1]; /* applies while no record is valid */
+#ifdef _TRIM_RECORDS_
+  struct trim_record slot[TRIM_SLOTS];
+#endif // ifdef _TRIM_RECORDS_
+};
+EEMEM struct trim_eeprom trimStore =
+{
+  {
+    {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 1 = Joy 1 X */
+    {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 2 = Joy 1 Y */
+    {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}, /* Pot 3 = Joy 2 X */
+    {STICK_AT_MIN_RESI, STICK_AT_MAX_RESI, RESCALING_FACTOR}  /* Pot 4 = Joy 2 Y */
+  },
+#ifdef _TRIM_RECORDS_
+  {}                                                        /* no record yet */
+#endif // ifdef _TRIM_RECORDS_
 };
 
 
+/* ########################################################################## */
+// channel table: charge bit of each pot, the index is its scan slot as well
+// as its place in frame, captures and trim
+const uint8_t potTable[RESULT_SIZE-1] PROGMEM = POT_TABLE;
+
+
 /* ########################################################################## */
 // global variables, interface between IRQ and normal mode routines
 volatile  uint16_t  captured[RESULT_SIZE-1];
 volatile  uint8_t   whoIsNext = JOY1_X_INDEX;
-volatile  uint8_t   whoIsReady = JOY1_X_INDEX;
-volatile  uint8_t   updated = 0;
+volatile  uint8_t   pending = 0;              /* pots not rescaled yet */
+#ifdef _PERF_COUNTERS_
+volatile  uint8_t   droppedSamples = 0;       /* overwritten, saturating */
+#endif // ifdef _PERF_COUNTERS_
 volatile  uint8_t   key_state;
+volatile  uint8_t   result[RESULT_SIZE];      /* scan cycle under way */
+volatile  uint8_t   frame[FRAME_BUFFERS][FRAME_SIZE]; /* published cycles */
+#ifdef _DOUBLE_BUFFERED_FRAME_
+volatile  uint8_t   frontFrame = 0;           /* most recent frame */
+#else
+#define             frontFrame  0             /* the only frame */
+#endif // ifdef _DOUBLE_BUFFERED_FRAME_
+volatile  uint8_t   twiFrame = NO_FRAME;      /* frame read by TWI burst */
+volatile  uint8_t   twiPointer = regJoyAll;   /* TWI register map */
+volatile  uint8_t   calibrationRequest = 0; /* 0 = none pending */
+#ifdef _TRIM_RECORDS_
+uint8_t             storeSequence;            /* of newest record */
+uint8_t             storeSlot;                /* newest record or NO_SLOT */
+volatile  uint8_t   storeCrc;                 /* of the bytes written */
+#endif // ifdef _TRIM_RECORDS_
+uint8_t             storePending = 0;         /* trims under way */
+uint8_t             storePatch;               /* offset of storeValue[0] */
+int16_t             storeValue[2];            /* two pots, same field */
+volatile  uint8_t   storeLeft = 0;            /* bytes for EE_READY IRQ */
+struct    trim_cache trimCache[RESULT_SIZE-1]; /* RAM copy for conversion */
 #ifdef _ALSO_USE_UART_
 volatile  uint8_t   timeout = 3;
 #endif // ifdef _ALSO_USE_UART_
+#ifdef _SEND_ON_CHANGE_
+volatile  uint8_t   holdoff = 0;              /* T0 ticks to next message */
+#endif // ifdef _SEND_ON_CHANGE_
+#if defined _SEND_ON_CHANGE_ || defined _DELTA_FRAMES_
+uint8_t             lastSent[RESULT_SIZE];    /* frame sent last */
+#endif
+#ifdef _DELTA_FRAMES_
+uint8_t             txSequence = 0;           /* of next delta frame */
+#endif // ifdef _DELTA_FRAMES_
+#ifdef _VERIFY_DISCHARGE_
+volatile  uint8_t   dischargeFixed = 0;       /* scan cycle uses fixed one */
+volatile  uint8_t   scheduledFixed = 0;       /* discharge under way */
+volatile  uint8_t   readyAfterFixed = 0;      /* pending pots after fixed */
+uint16_t            verifyRaw[RESULT_SIZE-1]; /* last sample after fixed */
+uint8_t             verifyFailed = 0;         /* last comparison, per pot */
+#endif // ifdef _VERIFY_DISCHARGE_
+#ifdef _CHANGE_NOTIFICATION_
+volatile  uint8_t   changeRead = NO_FRAME;    /* frame read by master */
+uint8_t             reported[RESULT_SIZE];    /* values read by master */
+#endif // ifdef _CHANGE_NOTIFICATION_
+#ifdef _OVERSAMPLING_
+struct    filter_data filter[RESULT_SIZE-1];
+uint8_t             ringIndex = 0;            /* same slot for all pots */
+uint8_t             filterSeed = POT_CHANNEL_MASK; /* pots to restart filter */
+volatile  uint16_t  fine[RESULT_SIZE-1];      /* high resolution readings */
+#endif // ifdef _OVERSAMPLING_
+#ifdef _AUTO_RANGING_
+struct    autorange_data range[RESULT_SIZE-1];
+uint8_t             rangeSeed = 0;            /* pots to learn anew */
+uint8_t             rangeApplied = 0;         /* range is trim, not stored */
+uint16_t            rangeStable = 0;          /* scan cycles unchanged */
+#endif // ifdef _AUTO_RANGING_
+#ifdef _CAPTURE_RECORDER_
+volatile  uint16_t  recTagged[RECORDER_SIZE]; /* capture, pot index 15..14 */
+volatile  uint8_t   recStamp[RECORDER_SIZE];  /* TCNT0, 16us ticks (4MHz) */
+volatile  uint8_t   recHead = 0;              /* next sample to record */
+volatile  uint8_t   recCount = 0;             /* samples held */
+volatile  uint8_t   recPost = 0;              /* samples to go after trigger */
+volatile  uint8_t   recState = 0;             /* JOY_RECORDER_... */
+#endif // ifdef _CAPTURE_RECORDER_
+#ifdef _PERF_COUNTERS_
+volatile  struct    perf_counters perf;
+uint16_t            loopCount = 0;            /* passes in this scan cycle */
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _NOISE_STATS_
+volatile  struct    stats_data noise[RESULT_SIZE-1]; /* last window */
+uint8_t             statsPot = JOY1_X_INDEX;  /* window under way */
+uint8_t             statsCount = 0;           /* samples in window */
+int16_t             statsSum;                 /* deviations from the mean */
+uint32_t            statsSquares;             /* squared deviations, or
+                                                 STATS_SATURATED */
+int8_t              statsMin;                 /* deviations, too */
+int8_t              statsMax;
+#endif // ifdef _NOISE_STATS_
+#ifdef _WATCHDOG_
+uint8_t             resetCause;               /* MCUSR at start up */
+#endif // ifdef _WATCHDOG_
+#ifdef _BUTTON_EVENTS_
+volatile  uint8_t   evCode[BUTTON_EVENT_SIZE]; /* JOY_EVENT_... */
+volatile  uint8_t   evStamp[BUTTON_EVENT_SIZE]; /* T0 ticks at the edge */
+volatile  uint8_t   evHead = 0;               /* next event to queue */
+volatile  uint8_t   evState = 0;              /* events held, JOY_EVENTS_LOST */
+volatile  uint8_t   evTicks = 0;              /* T0 overflows, wrapping */
+#ifdef _ALSO_USE_UART_
+volatile  uint8_t   buttonTaps = 0;           /* presses since frame sent */
+#endif // ifdef _ALSO_USE_UART_
+#endif // ifdef _BUTTON_EVENTS_
 
 
 #ifdef _ALSO_USE_UART_
@@ -154,6 +588,36 @@ volatile  uint8_t   timeout = 3;
 
 #define FLAG_ACCU_IS_EMPTY    (1<<4) /* accumulator voltage too low */
 
+#define TELEMETRY_MIN_MS        20UL    // send on change: minimum interval
+#define TELEMETRY_HEARTBEAT_MS  800UL   // send on change: maximum interval
+#define TELEMETRY_MIN_TICKS     ((TELEMETRY_MIN_MS * 1000 + T0_TICK_US - 1) / T0_TICK_US)
+#define TELEMETRY_HEARTBEAT_TICKS (TELEMETRY_HEARTBEAT_MS * 1000 / T0_TICK_US)
+#if (TELEMETRY_HEARTBEAT_TICKS > 255)
+#error: TELEMETRY_HEARTBEAT_MS exceeds 8 bit tick counter!
+#endif
+
+#define TELEMETRY_KEY_PERIOD    8       // delta frames: power of 2
+
+#ifdef _DELTA_FRAMES_
+#define TX_RING_SIZE    16      // power of 2, takes one keyframe
+#else
+#define TX_RING_SIZE    8       // power of 2, takes one joystick message
+#endif // ifdef _DELTA_FRAMES_
+#define ENABLE_TX_IRQ   TXCTRLREG |= (1 << UDRIE)
+#define DISABLE_TX_IRQ  TXCTRLREG &= ~(1 << UDRIE)
+
+volatile uint8_t txRing[TX_RING_SIZE];
+volatile uint8_t txHead = 0;    // next byte to send, moved by IRQ only
+volatile uint8_t txTail = 0;    // next free slot, moved by main loop only
+
+#define RX_RING_SIZE    4       // power of 2, takes one battery message
+
+volatile uint8_t rxRing[RX_RING_SIZE];
+volatile uint8_t rxHead = 0;    // next byte to parse, moved by main loop only
+volatile uint8_t rxTail = 0;    // next free slot, moved by IRQ only
+volatile uint8_t rxOverruns = 0;    // bytes lost by UART or ring, saturating
+volatile uint8_t rxFrameErrors = 0; // damaged bytes, saturating
+
 void initCom (void)
 // init UART and handshake IO
 {
@@ -164,39 +628,199 @@ void initCom (void)
   // init U(S)ART
   UBRRH = ((F_CPU/(16*F_BAUD))-1) >> 8;
   UBRRL = ((F_CPU/(16*F_BAUD))-1) & 0x00ff;
-  TXCTRLREG = ((1 << TXENABLE) | (1 << RXENABLE));
+  TXCTRLREG = ((1 << TXENABLE) | (1 << RXENABLE) | (1 << RXCIE));
+}
+
+ISR(USART_UDRE_vect)
+// transmitter ready: send next byte of the ring
+// stops if ring is empty or /RTS is inactive, see kickTransmitter()
+{
+  if ((txHead == txTail) || isRTSinactive)
+    DISABLE_TX_IRQ;
+  else
+  {
+    TXDATAREG = txRing[txHead];
+    txHead = (txHead + 1) & (TX_RING_SIZE - 1);
+  }
+}
+
+void kickTransmitter (void)
+// to be called in main loop: resume transmission once /RTS is active again
+{
+  if ((txHead != txTail) && !isRTSinactive)
+    ENABLE_TX_IRQ;
 }
 
 void putChar (uint8_t data)
-// transmit one byte
+// put one byte into the ring - caller checks for space!
 {
-  while (isTxFull) {}       // wait until transmitter ready
-  while (isRTSinactive) {}  // wait until transmission allowed
-  TXDATAREG = data;          // send away
+  txRing[txTail] = data;
+  txTail = (txTail + 1) & (TX_RING_SIZE - 1);
 }
 
-void sendSequence (void *ptr, uint8_t byteCount)
-// transmit a certain count of bytes
+uint8_t sendSequence (void *ptr, uint8_t byteCount)
+// queue a certain count of bytes for transmission, does not wait
+// the message is dropped as a whole if the ring has no room for it
+// returns '0' if dropped
 {
   uint8_t *p = (uint8_t *) ptr;
+  if (((txHead - txTail - 1) & (TX_RING_SIZE - 1)) < (byteCount + 2))
+    return(0);
   putChar('J');         // Joystick message header
   while (byteCount--)
     putChar(*p++);
   putChar(~'J');        // joystick message termination
+  kickTransmitter();
+  return(~0);
+}
+
+#ifdef _DELTA_FRAMES_
+uint8_t sendDeltaFrame (volatile uint8_t *values)
+// queue values as frame of telemetry.h, a keyframe is due periodically or if
+// a difference does not fit into 8 bits
+// returns '0' if dropped (nothing changes then, the next try repeats it)
+{
+  uint8_t type = TELEMETRY_DELTA;
+  uint8_t mask = 0;
+  uint8_t size = 4;
+  if (!(txSequence & (TELEMETRY_KEY_PERIOD - 1)))
+    type = TELEMETRY_KEYFRAME;
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+  {
+    int16_t delta = values[j] - lastSent[j];
+    if (delta)
+    {
+      mask |= 1 << j;
+      size++;
+    }
+    if ((delta > 127) || (delta < -128))
+      type = TELEMETRY_KEYFRAME;
+  }
+  if (type == TELEMETRY_KEYFRAME)
+  {
+    mask = TELEMETRY_ALL;
+    size = 4 + RESULT_SIZE;
+  }
+  if (((txHead - txTail - 1) & (TX_RING_SIZE - 1)) < size)
+    return(0);
+  uint8_t crc = telemetry_crc8(0, TELEMETRY_HEADER(type));
+  putChar(TELEMETRY_HEADER(type));
+  crc = telemetry_crc8(crc, txSequence);
+  putChar(txSequence++);
+  crc = telemetry_crc8(crc, mask);
+  putChar(mask);
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+  {
+    if (mask & (1 << j))
+    {
+      uint8_t data = values[j];
+      if ((type == TELEMETRY_DELTA) && (j != JOYPBS_INDEX))
+        data -= lastSent[j];
+      crc = telemetry_crc8(crc, data);
+      putChar(data);
+    }
+    lastSent[j] = values[j];
+  }
+  putChar(crc);
+  kickTransmitter();
+  return(~0);
+}
+#endif // ifdef _DELTA_FRAMES_
+
+uint8_t sendFrame (volatile uint8_t *values)
+// queue joystick values in the format selected
+// returns '0' if dropped
+{
+#ifdef _BUTTON_EVENTS_
+  /* presses since the last frame show even if released meanwhile */
+  uint8_t tapped[RESULT_SIZE];
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    tapped[j] = values[j];
+  cli();
+  uint8_t taps = buttonTaps;
+  sei();
+  tapped[JOYPBS_INDEX] |= taps;
+  values = tapped;
+#endif // ifdef _BUTTON_EVENTS_
+#ifdef _DELTA_FRAMES_
+  if (!sendDeltaFrame(values))
+    return(0);
+#else
+  if (!sendSequence((void*) values, RESULT_SIZE))
+    return(0);
+#ifdef _SEND_ON_CHANGE_
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    lastSent[j] = values[j];
+#endif // ifdef _SEND_ON_CHANGE_
+#endif // ifdef _DELTA_FRAMES_
+#ifdef _BUTTON_EVENTS_
+  cli();
+  buttonTaps &= ~taps;
+  sei();
+#endif // ifdef _BUTTON_EVENTS_
+  return(~0);
+}
+
+#ifdef _SEND_ON_CHANGE_
+void sendOnChange (uint8_t index)
+// send frame if it differs from the one sent last (or heartbeat is due) and
+// minimum interval has passed, a frame not sent is tried again next time
+{
+  uint8_t changed = !timeout;
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    if (frame[index][j] != lastSent[j])
+      changed = ~0;
+#ifdef _BUTTON_EVENTS_
+  if (buttonTaps)
+    changed = ~0;
+#endif // ifdef _BUTTON_EVENTS_
+  if (!changed || holdoff)
+    return;
+  if (!sendFrame(&frame[index][0]))
+    return;
+  cli();
+  holdoff = TELEMETRY_MIN_TICKS;
+  timeout = TELEMETRY_HEARTBEAT_TICKS;
+  sei();
+}
+#endif // ifdef _SEND_ON_CHANGE_
+
+ISR(USART_RX_vect)
+// byte received: put it into the ring, count lost and damaged bytes
+{
+  uint8_t status = RXSTATREG;   // flags belong to the byte in RXDATAREG
+  uint8_t data = RXDATAREG;
+  uint8_t next = (rxTail + 1) & (RX_RING_SIZE - 1);
+  if ((status & (1 << DOR)) || (next == rxHead))
+  {
+    if (rxOverruns < 0xFF)
+      rxOverruns++;
+  }
+  if (status & (1 << FE))
+  {
+    if (rxFrameErrors < 0xFF)
+      rxFrameErrors++;
+  }
+  else if (next != rxHead)
+  {
+    rxRing[rxTail] = data;
+    rxTail = next;
+  }
 }
 
 uint8_t getChar (int8_t *ptr)
-// check reception status, also report received byte
+// fetch received byte from the ring
 // returns '0' if nothing is in
 {
-  if (isRxEmpty)
+  if (rxHead == rxTail)
     return(0);
-  *ptr = RXDATAREG;
+  *ptr = rxRing[rxHead];
+  rxHead = (rxHead + 1) & (RX_RING_SIZE - 1);
   return(~0);
 }
 
 void decodeReception (void)
-// scans incoming stream for battery message and updates LED
+// scans all bytes received so far for battery message and updates LED
 {
   enum
   {
@@ -226,10 +850,13 @@ void decodeReception (void)
             LEDPORT &= ~(1 << LEDBIT);
           else
             LEDPORT |= (1 << LEDBIT);
+#ifndef _SEND_ON_CHANGE_
           cli();
           timeout = 0;
           sei();
+#endif // ifndef _SEND_ON_CHANGE_
         }
+        // fall through - message complete or broken, look for next header
       default:
         decoder_state = await_header;
     }
@@ -240,60 +867,187 @@ void decodeReception (void)
 
 
 /* ########################################################################## */
-// read out actual pot value - also checks for timeout
-// start discharge cycle
-ISR(TIMER1_COMPA_vect)
+#ifdef _ADAPTIVE_DISCHARGE_
+// discharge time needed after a sample, charging ended at Vref (capture)
+// or below (timeout), so the same for every sample
+#ifdef _VERIFY_DISCHARGE_
+#define discharge_clocks(sample) \
+  (dischargeFixed ? DISCHARGE_CLOCKS : DISCHARGE_FROM_VREF)
+#else
+#define discharge_clocks(sample) DISCHARGE_FROM_VREF
+#endif // ifdef _VERIFY_DISCHARGE_
+#else
+#define discharge_clocks(sample) DISCHARGE_CLOCKS
+#endif // ifdef _ADAPTIVE_DISCHARGE_
+
+
+#ifdef _CAPTURE_RECORDER_
+// record a sample, the oldest one gets lost when full, after the trigger
+// RECORDER_POST_TRIGGER samples are taken before the recorder stops
+static inline void record_capture (uint8_t index, uint16_t sample) __attribute__((always_inline));
+static inline void record_capture (uint8_t index, uint16_t sample)
+{
+  if (sample > RECORDER_CAPTURE_MASK)
+    sample = RECORDER_CAPTURE_MASK;
+  recTagged[recHead] = sample | ((uint16_t) index << 14);
+  recStamp[recHead] = TCNT0;
+  recHead = (recHead + 1) & (RECORDER_SIZE - 1);
+  if (recCount < RECORDER_SIZE)
+    recCount++;
+  if ((recState & JOY_RECORDER_TRIGGERED) && !--recPost)
+    recState &= ~JOY_RECORDER_RUNNING;
+}
+#endif // ifdef _CAPTURE_RECORDER_
+
+
+// end of conversion: store sample and start discharge cycle, the next
+// conversion is due after discharging relative to endTime
+static inline void end_of_conversion (uint16_t sample, uint16_t endTime) __attribute__((always_inline));
+static inline void end_of_conversion (uint16_t sample, uint16_t endTime)
 {
   STOP_CHARGING;
   START_DISCHARGING;
-  whoIsReady = whoIsNext;
-  if (CAPTURE_OCCURED)
-    // store time stamp
-    captured[whoIsNext] = CAPTURE_RESULT_REG;
-  else
-    // indicate maximum
-    captured[whoIsNext] = ~0;
+  uint8_t bit = 1 << whoIsNext;
+#ifdef _PERF_COUNTERS_
+  if ((pending & bit) && (droppedSamples < 0xFF))
+    droppedSamples++; // main loop missed the sample before
+#endif // ifdef _PERF_COUNTERS_
+  pending |= bit;
+  captured[whoIsNext] = sample;
+#ifdef _PERF_COUNTERS_
+  if (sample > CAPTURE_LIMIT)
+    perf.timeouts[whoIsNext]++;
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _CAPTURE_RECORDER_
+  if (recState & JOY_RECORDER_RUNNING)
+    record_capture(whoIsNext, sample);
+#endif // ifdef _CAPTURE_RECORDER_
   whoIsNext += 1;
-  if (whoIsNext > JOY2_Y_INDEX)
+  if (whoIsNext >= POT_CHANNELS)
     whoIsNext = JOY1_X_INDEX;
+#ifdef _VERIFY_DISCHARGE_
+  if (scheduledFixed)
+    readyAfterFixed |= bit;
+  else
+    readyAfterFixed &= ~bit;
+  if (whoIsNext == JOY1_X_INDEX)
+    dischargeFixed ^= 1;
+  scheduledFixed = dischargeFixed;
+#endif // ifdef _VERIFY_DISCHARGE_
+#ifdef _EARLY_END_OF_CONVERSION_
+  OCR1B = T1_DISCHARGE_COMPARE(endTime, discharge_clocks(sample));
+#else
+  (void) endTime; /* fixed schedule, OCR1B stays */
+#endif
   CLEAR_CAPTURE_FLAG;
-  updated = ~0;
 }
 
 
+// read out actual pot value - also checks for timeout
+ISR(TIMER1_COMPA_vect)
+{
+#ifdef _EARLY_END_OF_CONVERSION_
+  DISABLE_END_OF_CONV_IRQS;
+#endif // ifdef _EARLY_END_OF_CONVERSION_
+  uint16_t sample = ~0; // indicate maximum
+  if (CAPTURE_OCCURED)
+    sample = CAPTURE_RESULT_REG; // store time stamp
+  end_of_conversion(sample, CAPTURE_LIMIT);
+}
+
+
+#ifdef _EARLY_END_OF_CONVERSION_
+// comparator tripped: take sample at once, next conversion is scheduled
+// relative to this time stamp
+ISR(TIMER1_CAPT_vect)
+{
+  uint16_t stamp = CAPTURE_RESULT_REG;
+  DISABLE_END_OF_CONV_IRQS;
+  end_of_conversion(stamp, stamp);
+}
+#endif // ifdef _EARLY_END_OF_CONVERSION_
+
+
 /* ########################################################################## */
 // end discharge cycle
 // prepare next conversion
 ISR(TIMER1_COMPB_vect)
 {
+#ifdef _PERF_COUNTERS_
+  uint16_t late = TCNT1 - OCR1B;
+  if (late > perf.irqLatencyMax)
+    perf.irqLatencyMax = late;
+#endif // ifdef _PERF_COUNTERS_
   STOP_T1_OPERATION;
   CLEAR_T1_COUNT_REG;
   STOP_DISCHARGING;
-  switch (whoIsNext) /* start next charging cycle */
+  uint8_t charge = pgm_read_byte(&potTable[whoIsNext]);
+  CHARGE_POT(charge); /* start next charging cycle */
+#ifdef _EARLY_END_OF_CONVERSION_
+  OCR1B = T1_SCAN_COMPARE; /* must not end the slot before the timeout */
+  ENABLE_END_OF_CONV_IRQS;
+#endif // ifdef _EARLY_END_OF_CONVERSION_
+  START_T1_OPERATION;
+}
+
+
+#ifdef _BUTTON_EVENTS_
+/* ########################################################################## */
+// button events (timer 0 IRQ): queue a debounced edge with its time stamp, a
+// full FIFO drops it and flags the loss
+void button_event (uint8_t button, uint8_t pressed)
+{
+  if (pressed)
   {
-    case JOY1_X_INDEX:
-      POT_DDR |= POT1_BIT;
-      POT_PORT |= POT1_BIT;
-      break;
-    case JOY1_Y_INDEX:
-      POT_DDR |= POT2_BIT;
-      POT_PORT |= POT2_BIT;
-      break;
-    case JOY2_X_INDEX:
-      POT_DDR |= POT3_BIT;
-      POT_PORT |= POT3_BIT;
-      break;
-    case JOY2_Y_INDEX:
-      POT_DDR |= POT4_BIT;
-      POT_PORT |= POT4_BIT;
-      break;
-    default:
-      ;
+    button |= JOY_EVENT_PRESSED;
+#ifdef _ALSO_USE_UART_
+    buttonTaps |= button & JOY_EVENT_BUTTON;
+#endif // ifdef _ALSO_USE_UART_
   }
-  START_T1_OPERATION;
+  if ((evState & ~JOY_EVENTS_LOST) >= BUTTON_EVENT_SIZE)
+  {
+    evState |= JOY_EVENTS_LOST;
+    return;
+  }
+  evCode[evHead] = button;
+  evStamp[evHead] = evTicks;
+  evHead = (evHead + 1) & (BUTTON_EVENT_SIZE - 1);
+  evState++;
 }
 
 
+// read out of the events (USI IRQ): state and ticks now at start, then the
+// events held, oldest first, an event is removed with its last byte
+uint8_t button_events_read (uint8_t start)
+{
+  static uint8_t byteIndex;
+  if (start)
+  {
+    byteIndex = 0;
+    uint8_t state = evState;
+    evState &= ~JOY_EVENTS_LOST;
+    return (state);
+  }
+  if (byteIndex == 0)
+  {
+    byteIndex = 1;
+    return (evTicks);
+  }
+  if (!evState)
+    return (~0);
+  uint8_t oldest = (evHead - evState) & (BUTTON_EVENT_SIZE - 1);
+  if (byteIndex == 1)
+  {
+    byteIndex = 2;
+    return (evCode[oldest]);
+  }
+  byteIndex = 1;
+  evState--;
+  return (evStamp[oldest]);
+}
+#endif // ifdef _BUTTON_EVENTS_
+
+
 /* ########################################################################## */
 // key scanning and debouncing - see credits
 // key edge detection and repetition not necessary, thus removed
@@ -307,57 +1061,445 @@ ISR(TIMER0_OVF_vect)
   i &= ct0 & ct1;                       // count until roll over?
   key_state ^= i;                       // then toggle debounced state
 
+#ifdef _BUTTON_EVENTS_
+  /* debounced edges, button bits as in the frame */
+  evTicks++;
+  if (i & BUTTON1_BIT)
+    button_event(0x01, key_state & BUTTON1_BIT);
+#ifndef _ALSO_USE_UART_
+  if (i & BUTTON2_BIT)                  // /RTS with UART
+    button_event(0x02, key_state & BUTTON2_BIT);
+#endif // ifndef _ALSO_USE_UART_
+  if (i & BUTTON3_BIT)
+    button_event(0x04, key_state & BUTTON3_BIT);
+  if (i & BUTTON4_BIT)
+    button_event(0x08, key_state & BUTTON4_BIT);
+#endif // ifdef _BUTTON_EVENTS_
+  /* stalled TWI transfer: release the bus */
+#ifdef _PERF_COUNTERS_
+  if (twi_slaveSupervise() != __twiOk__)
+    count_twi(1);
+#else
+  twi_slaveSupervise();
+#endif // ifdef _PERF_COUNTERS_
 #ifdef _ALSO_USE_UART_
   if (timeout)
     timeout -= 1;
 #endif // ifdef _ALSO_USE_UART_
+#ifdef _SEND_ON_CHANGE_
+  if (holdoff)
+    holdoff -= 1;
+#endif // ifdef _SEND_ON_CHANGE_
 }
 
 
 /* ########################################################################## */
 // EEPROM handling
+// NOTE: EEAR/EEDR are only touched with interrupts disabled, so these routines
+// may be used from IRQ context as well
 // read out a byte
 uint8_t EEPROM_read_byte(unsigned int address)
 {
   while (EECR & (1 << EEPE));
+  uint8_t sreg = SREG;
+  cli();
   EEAR = address;
   EECR |= (1 << EERE);
-  return (EEDR);
+  uint8_t data = EEDR;
+  SREG = sreg;
+  return (data);
 }
 
 
 // EEPROM handling
-// read out a word (2 bytes)
-unsigned int EEPROM_read_word(unsigned int address)
+// read out a block (not while trims are written but by the EE_READY IRQ
+// itself, see trim_store)
+void EEPROM_read_block(void *data, unsigned int address, uint8_t size)
 {
-  while (EECR & (1 << EEPE));
-  EEAR = address++;
-  EECR |= (1 << EERE);
-  unsigned int data = EEDR;
-  EEAR = address;
+  uint8_t *p = (uint8_t*) data;
+  while (size--)
+    *p++ = EEPROM_read_byte(address++);
+}
+
+
+/* ########################################################################## */
+// calculate conversion factor from trim points (but only if points are valid
+// and wide enough for a factor other than 0, else the factor is kept)
+void calculate_trim_factor (struct trim_data *t)
+{
+  if (((uint16_t)t->max_resi < CAPTURE_LIMIT) \
+    && ((uint16_t)t->min_resi < CAPTURE_LIMIT))
+  {
+    int16_t trim_factor = t->max_resi;
+    trim_factor -= t->min_resi;
+    // allow for better precision multiplying by 6 (= 2 + 4)
+    trim_factor = (trim_factor << 1) + (trim_factor << 2);
+    trim_factor = trim_factor / (int16_t)(DESIRED_MAX_READING - DESIRED_MIN_READING + 1);
+    if (trim_factor)
+      t->factor = trim_factor;
+  }
+}
+
+
+/* ########################################################################## */
+// trim of a pot as it applies now: the learned range if auto ranging changed
+// it, else the newest record, the trim table if there is none
+void trim_get (uint8_t index, struct trim_data *t)
+{
+  struct trim_data *source = &trimStore.joyTrim[index];
+#ifdef _TRIM_RECORDS_
+  if (storeSlot != NO_SLOT)
+    source = &trimStore.slot[storeSlot].trim[index];
+#endif // ifdef _TRIM_RECORDS_
+  EEPROM_read_block(t, (unsigned int) source, sizeof(*t));
+#ifdef _AUTO_RANGING_
+  if (rangeApplied & (1 << index))
+  { /* the factor follows the range */
+    t->min_resi = range[index].min;
+    t->max_resi = range[index].max;
+    calculate_trim_factor(t);
+  }
+#endif // ifdef _AUTO_RANGING_
+}
+
+
+// byte of the trims in table order (offset from the first), for TWI and for
+// the EEPROM writer
+uint8_t trim_byte (uint8_t offset)
+{
+#if !defined _TRIM_RECORDS_ && !defined _AUTO_RANGING_
+  /* the trim table is in use as it is */
+  return (EEPROM_read_byte((unsigned int) &trimStore.joyTrim[0] + offset));
+#else
+  struct trim_data t;
+  uint8_t index = JOY1_X_INDEX;
+  while (offset >= sizeof(t))
+  {
+    offset -= sizeof(t);
+    index++;
+  }
+  trim_get(index, &t);
+  return (((uint8_t*) &t)[offset]);
+#endif
+}
+
+
+#ifdef STORE_ALL_TRIMS
+// byte of the trims to store: storeValue[] at offset storePatch (and one
+// struct trim_data further), else the trim in use
+uint8_t store_byte (uint8_t offset)
+{
+  uint8_t j = offset - storePatch;
+  if (j < sizeof(storeValue[0]))
+    return (((uint8_t*) &storeValue[0])[j]);
+  j -= sizeof(struct trim_data);
+  if (j < sizeof(storeValue[1]))
+    return (((uint8_t*) &storeValue[1])[j]);
+  return (trim_byte(offset));
+}
+#endif // ifdef STORE_ALL_TRIMS
+
+
+// EEPROM ready: compare next byte to store (storeLeft bytes to go), write it
+// if it differs, one byte per IRQ keeps the IRQ short; the trim table is
+// updated in place (just storeValue[] if nothing else changes); a record
+// goes to the slot after the newest, its version byte is cleared first and
+// written last, so a record torn by a reset is never taken, in between
+// follow the sequence number, the trims and the CRC of the bytes before
+ISR(EEPROM_READY_vect)
+{
+  uint8_t left = storeLeft;
+  if (!left)
+  {
+    EECR &= ~(1 << EERIE);
+    return;
+  }
+#ifdef _TRIM_RECORDS_
+  uint8_t slot = storeSlot + 1; /* NO_SLOT wraps to 0 */
+  if (slot >= TRIM_SLOTS)
+    slot = 0;
+  struct trim_record *record = &trimStore.slot[slot];
+  uint8_t *address = &record->version;
+  uint8_t data = TRIM_RECORD_VERSION;
+  if (left > sizeof(*record))
+  {
+    data = 0xFF; /* erased, not valid */
+    storeCrc = telemetry_crc8(0, TRIM_RECORD_VERSION);
+  }
+  else if (left > 1)
+  {
+    address = &record->crc + 2 - left;
+    data = storeCrc;
+    if (address == &record->sequence)
+      data = storeSequence + 1;
+    else if (address != &record->crc)
+      data = store_byte(address - (uint8_t*) &record->trim[0]);
+    storeCrc = telemetry_crc8(storeCrc, data);
+  }
+#elif defined STORE_ALL_TRIMS
+  uint8_t offset = sizeof(trimStore.joyTrim) - left;
+  uint8_t *address = (uint8_t*) &trimStore.joyTrim[0] + offset;
+  uint8_t data = store_byte(offset);
+#else
+  uint8_t j = sizeof(storeValue) - left;
+  uint8_t *address = (uint8_t*) &trimStore.joyTrim[0] + storePatch + j;
+  if (j >= sizeof(storeValue[0]))
+    address += sizeof(struct trim_data) - sizeof(storeValue[0]);
+  uint8_t data = ((uint8_t*) storeValue)[j];
+#endif // ifdef _TRIM_RECORDS_
+  EEAR = (unsigned int) address;
   EECR |= (1 << EERE);
-  return (data | (EEDR << 8));
+  if (EEDR != data)
+  {
+    EEDR = data;
+    EECR |= (1 << EEMPE);
+    EECR |= (1 << EEPE);
+  }
+  storeLeft = left - 1;
 }
 
 
-// EEPROM handling
-// write a word (2 bytes)
-void EEPROM_write_word(unsigned int address, unsigned int data)
+/* ########################################################################## */
+// take the trim in use of a pot into the RAM copy for conversion, including
+// the multiply-and-shift replacement for division by conversion factor (done
+// at boot and once per calibration, so the division here does not hurt)
+void trim_cache (uint8_t index)
+{
+  struct trim_data t;
+  trim_get(index, &t);
+  struct trim_cache *c = &trimCache[index];
+  c->min_resi = t.min_resi;
+#if !defined _RECIPROCAL_RESCALING_ || defined _VERIFY_RESCALING_
+  c->factor = t.factor;
+#endif
+#ifdef _RECIPROCAL_RESCALING_
+  rescale_reciprocal(t.factor, &c->rescale);
+#endif // ifdef _RECIPROCAL_RESCALING_
+}
+
+
+// convert raw capture into output range, |rawResult| < 2^15 as captures
+// beyond CAPTURE_LIMIT are not rescaled; kept out of line, so 'make bench'
+// finds it as a call to measure
+int16_t rescale_capture (uint8_t index, uint16_t rawValue) __attribute__((noinline));
+int16_t rescale_capture (uint8_t index, uint16_t rawValue)
+{
+  struct trim_cache *c = &trimCache[index];
+  int16_t rawResult = (int16_t)rawValue - c->min_resi;
+  // allow for better precision multiplying by 6 (= 2 + 4)
+  rawResult = (rawResult << 1) + (rawResult << 2);
+#ifdef _RECIPROCAL_RESCALING_
+  return (rescale_divide(rawResult, &c->rescale));
+#else
+  return (rawResult / c->factor);
+#endif // ifdef _RECIPROCAL_RESCALING_
+}
+
+
+#ifdef _OVERSAMPLING_
+// put a valid capture into the ring of its pot and filter the ring sum
+// returns the filter output (FILTER_FRACTION fractional bits), a pot flagged
+// in filterSeed (e.g. invalid before) starts over from this capture
+uint16_t oversample (uint8_t index, uint16_t rawValue)
+{
+  struct filter_data *f = &filter[index];
+  uint8_t mask = 1 << index;
+  if (filterSeed & mask)
+  {
+    filterSeed &= ~mask;
+    for (uint8_t j = 0; j < (1 << OVERSAMPLING_SHIFT); j++)
+      f->ring[j] = rawValue;
+    f->accu = rawValue << FILTER_FRACTION;
+  }
+  f->ring[ringIndex] = rawValue;
+  uint16_t sum = 0;
+  for (uint8_t j = 0; j < (1 << OVERSAMPLING_SHIFT); j++)
+    sum += f->ring[j];
+  // accu = accu * (1 - 2^-FILTER_SHIFT) + sum, no loss of fractional bits
+  f->accu = f->accu - (f->accu >> FILTER_SHIFT) + sum;
+  return (f->accu);
+}
+
+
+// like rescale_capture() on the filter output, keeping HIRES_SHIFT fractional
+// bits of the result, n * reciprocal is done in two parts to stay in 32 bits
+int16_t rescale_fine (uint8_t index, uint16_t filtered)
+{
+  struct trim_cache *c = &trimCache[index];
+  int32_t rawResult = (int32_t)filtered - \
+    ((int32_t)c->min_resi << FILTER_FRACTION);
+  rawResult = (rawResult << 1) + (rawResult << 2);
+#ifdef _RECIPROCAL_RESCALING_
+  struct rescale_data *r = &c->rescale;
+  uint8_t negative = (r->shift & RESCALE_NEGATIVE) ? (rawResult >= 0) : (rawResult < 0);
+  uint32_t n = (rawResult < 0) ? -rawResult : rawResult;
+  uint32_t p = (n >> 8) * r->reciprocal + (((n & 0xFF) * r->reciprocal) >> 8);
+  uint16_t q = p >> (7 + FILTER_FRACTION - HIRES_SHIFT + (r->shift & ~RESCALE_NEGATIVE));
+  return (negative ? -(int16_t)q : (int16_t)q);
+#else
+  return ((rawResult << HIRES_SHIFT) / ((int32_t)c->factor << FILTER_FRACTION));
+#endif // ifdef _RECIPROCAL_RESCALING_
+}
+#endif // ifdef _OVERSAMPLING_
+
+
+#ifdef _VERIFY_RESCALING_
+// reference for rescale_capture(), the division it replaces
+int16_t rescale_reference (uint8_t index, uint16_t rawValue)
+{
+  struct trim_cache *c = &trimCache[index];
+  int16_t rawResult = (int16_t)rawValue - c->min_resi;
+  rawResult = (rawResult << 1) + (rawResult << 2);
+  return (rawResult / c->factor);
+}
+#endif // ifdef _VERIFY_RESCALING_
+
+
+/* ########################################################################## */
+// publish result[] of a completed scan cycle
+#ifdef _DOUBLE_BUFFERED_FRAME_
+// the back frame is filled and becomes the front one, deferred while a TWI
+// burst still reads the back one (TWI only ever picks the front frame, so no
+// need to block IRQs)
+uint8_t publish_frame (void)
+{
+  uint8_t back = frontFrame ^ 1;
+  if (twiFrame == back)
+    return (0);
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    frame[back][j] = result[j];
+  frame[back][FRAME_SEQ_INDEX] = frame[frontFrame][FRAME_SEQ_INDEX] + 1;
+  frontFrame = back;
+  return (~0);
+}
+#else
+// the only frame is overwritten, deferred while a TWI burst reads it (or the
+// read one is not acknowledged yet), IRQs blocked so no burst starts meanwhile
+uint8_t publish_frame (void)
 {
-  while (EECR & (1 << EEPE));
-  EEAR = address++;
-  EEDR = data;
-  cli();
-  EECR |= (1 << EEMPE);
-  EECR |= (1 << EEPE);
-  sei();
-  while (EECR & (1 << EEPE));
-  EEAR = address;
-  EEDR = data >> 8;
   cli();
-  EECR |= (1 << EEMPE);
-  EECR |= (1 << EEPE);
+  if ((twiFrame != NO_FRAME)
+#ifdef _CHANGE_NOTIFICATION_
+    || (changeRead != NO_FRAME)
+#endif // ifdef _CHANGE_NOTIFICATION_
+    )
+  {
+    sei();
+    return (0);
+  }
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    frame[0][j] = result[j];
+  frame[0][FRAME_SEQ_INDEX] += 1;
   sei();
+  return (~0);
+}
+#endif // ifdef _DOUBLE_BUFFERED_FRAME_
+
+
+#ifdef _CHANGE_NOTIFICATION_
+/* ########################################################################## */
+// data changed line: compare a frame to the values the master read last, the
+// deadband is taken against those, so jitter does not toggle the line
+void check_change (uint8_t index)
+{
+  uint8_t changed = (frame[index][JOYPBS_INDEX] != reported[JOYPBS_INDEX]);
+  for (uint8_t j = JOY1_X_INDEX; j < JOYPBS_INDEX; j++)
+  {
+    int16_t delta = frame[index][j] - reported[j];
+    if ((delta > CHANGE_DEADBAND) || (delta < -CHANGE_DEADBAND))
+      changed = ~0;
+  }
+  if (changed)
+    ASSERT_CHANGE_LINE;
+}
+
+
+// master has read a frame: take it as new reference (a single frame is not
+// published anew before, a double buffered one not before the next but one
+// publishing)
+void acknowledge_change (uint8_t index)
+{
+  for (uint8_t j = JOY1_X_INDEX; j < RESULT_SIZE; j++)
+    reported[j] = frame[index][j];
+}
+#endif // ifdef _CHANGE_NOTIFICATION_
+
+
+/* ########################################################################## */
+// trim data
+// at boot: with records find the newest valid one (sequence numbers of the
+// slots differ by less than 128), NO_SLOT if there is none: the trim table
+// applies then and the first record starts from it; load the RAM copy
+void trim_load(void)
+{
+#ifdef _TRIM_RECORDS_
+  uint8_t found = 0;
+  storeSlot = NO_SLOT;
+  storeSequence = ~0; /* first record gets 0 */
+  for (uint8_t slot = 0; slot < TRIM_SLOTS; slot++)
+  {
+    unsigned int address = (unsigned int) &trimStore.slot[slot];
+    unsigned int end = (unsigned int) &trimStore.slot[slot].crc;
+    uint8_t crc = 0;
+    for (; address < end; address++)
+      crc = telemetry_crc8(crc, EEPROM_read_byte(address)); /* as radio link */
+    if ((crc != EEPROM_read_byte(end)) \
+      || (EEPROM_read_byte((unsigned int) &trimStore.slot[slot].version) != TRIM_RECORD_VERSION))
+      continue;
+    uint8_t sequence = EEPROM_read_byte((unsigned int) &trimStore.slot[slot].sequence);
+    if (!found || ((int8_t)(sequence - storeSequence) > 0))
+    {
+      found = ~0;
+      storeSlot = slot;
+      storeSequence = sequence;
+    }
+  }
+#endif // ifdef _TRIM_RECORDS_
+  for (uint8_t j = JOY1_X_INDEX; j < (RESULT_SIZE-1); j++)
+    trim_cache(j);
+}
+
+
+// store the trims in use (the newest record or the trim table) with
+// storeValue[] patched in at offset patch (and patch + sizeof(struct
+// trim_data)), NO_PATCH takes them as they are (learned ranges go in anyway);
+// the EE_READY IRQ walks them byte by byte, reading its sources when due
+// they must not change meanwhile: calibration requests wait and auto ranging
+// pauses until the store is complete (storePending), so it holds one
+// consistent set of trims (and the CRC of a record); nothing else reads the
+// EEPROM meanwhile (TWI reads the trims as 0xFF)
+void trim_store(uint8_t patch)
+{
+  storePatch = patch;
+  storePending = ~0;
+#ifdef _TRIM_RECORDS_
+  storeLeft = sizeof(struct trim_record) + 1; /* version twice */
+#elif defined STORE_ALL_TRIMS
+  storeLeft = sizeof(trimStore.joyTrim);
+#else
+  storeLeft = sizeof(storeValue);
+#endif // ifdef _TRIM_RECORDS_
+  EECR |= (1 << EERIE);
+}
+
+
+// store complete: a record is the newest now, refresh the RAM copy - to be
+// called in main loop
+void trim_complete(void)
+{
+  if (!storePending || storeLeft || (EECR & (1 << EEPE)))
+    return;
+  storePending = 0;
+#ifdef _TRIM_RECORDS_
+  if (++storeSlot >= TRIM_SLOTS)
+    storeSlot = 0;
+  storeSequence += 1;
+#endif // ifdef _TRIM_RECORDS_
+#ifdef _AUTO_RANGING_
+  rangeApplied = 0; /* learned ranges are stored */
+#endif // ifdef _AUTO_RANGING_
+  for (uint8_t j = JOY1_X_INDEX; j < (RESULT_SIZE-1); j++)
+    trim_cache(j);
 }
 
 
@@ -379,50 +1521,513 @@ uint8_t msb(void* word)
 }
 
 
+#ifdef _PERF_COUNTERS_
 /* ########################################################################## */
-// calculate conversion factor from trim points (but only if points are valid)
-// and store to EEPROM (but only if different from value already stored)
-void calculate_trim_factor (int index)
+// performance counters: restart all of them (also dropped samples), IRQs
+// need to be disabled; the passes of the scan cycle under way keep counting,
+// a part of a cycle would be taken as the fewest
+void perf_clear (void)
 {
-  if ((EEPROM_read_word((unsigned int) &joyTrim[index].max_resi) < CAPTURE_LIMIT) \
-    && (EEPROM_read_word((unsigned int) &joyTrim[index].min_resi) < CAPTURE_LIMIT))
+  for (uint8_t j = 0; j < sizeof(perf); j++)
+    ((volatile uint8_t*) &perf)[j] = 0;
+  perf.loopsMin = ~0;
+  droppedSamples = 0;
+}
+
+
+// TWI events, called by the USI IRQs (see i2c.h)
+void count_twi (uint8_t aborted)
+{
+  if (aborted)
+    perf.twiAborted++;
+  else
+    perf.twiTransactions++;
+}
+#endif // ifdef _PERF_COUNTERS_
+
+
+/* ########################################################################## */
+// corner command: captures of a stick (X, Y) as minimum or maximum (field is
+// its offset in struct trim_data) of the trim, stored
+void store_corner (uint8_t index, uint8_t field)
+{
+  cli();
+  storeValue[0] = captured[index];
+  storeValue[1] = captured[index + 1];
+  sei();
+  trim_store(index * sizeof(struct trim_data) + field);
+}
+
+
+// conversion factor command: factors of a stick (X, Y) from the trim points
+// in use, stored
+void store_factors (uint8_t index)
+{
+  for (uint8_t j = 0; j < 2; j++)
   {
-    int16_t trim_factor = (int16_t)EEPROM_read_word((unsigned int) &joyTrim[index].max_resi);
-    trim_factor -= (int16_t)EEPROM_read_word((unsigned int) &joyTrim[index].min_resi);
-    // allow for better precision multiplying by 6 (= 2 + 4)
-    trim_factor = (trim_factor << 1) + (trim_factor << 2);
-    trim_factor = trim_factor / (int16_t)(DESIRED_MAX_READING - DESIRED_MIN_READING + 1);
-    if (trim_factor != (int16_t)EEPROM_read_word((unsigned int) &joyTrim[index].factor))
-      // only do a write if EEPROM contents is different
-      EEPROM_write_word((unsigned int) &joyTrim[index].factor, trim_factor);
+    struct trim_data t;
+    trim_get(index + j, &t);
+    calculate_trim_factor(&t);
+    storeValue[j] = t.factor;
+  }
+  trim_store(TRIM_OFFSET(index, factor));
+}
+
+
+#ifdef _AUTO_RANGING_
+/* ########################################################################## */
+// widen the learned range by a valid capture, a sample beyond the range needs
+// AUTORANGE_CONFIRM successors beyond it as well (single spikes are ignored),
+// the range then grows to the least excess of them; from AUTORANGE_MIN_SPAN
+// on the range is the trim of the pot and the factor follows each step; a
+// pot to learn anew first has its learned trim stored (not to be called while
+// a store is under way)
+void autorange (uint8_t index, uint16_t rawValue)
+{
+  struct autorange_data *r = &range[index];
+  if (rangeSeed & (1 << index))
+  {
+    if (rangeApplied & (1 << index))
+    {
+      trim_store(NO_PATCH);
+      return;
+    }
+    rangeSeed &= ~(1 << index);
+    r->min = rawValue;
+    r->max = rawValue;
+    r->confirm = 0;
+    return;
+  }
+  if (rawValue > r->max)
+  {
+    if (r->confirm <= 0)
+    {
+      r->confirm = 0;
+      r->candidate = rawValue;
+    }
+    else if (rawValue < r->candidate)
+      r->candidate = rawValue;
+    if (++r->confirm < AUTORANGE_CONFIRM)
+      return;
+    r->max = r->candidate;
+  }
+  else if (rawValue < r->min)
+  {
+    if (r->confirm >= 0)
+    {
+      r->confirm = 0;
+      r->candidate = rawValue;
+    }
+    else if (rawValue > r->candidate)
+      r->candidate = rawValue;
+    if (--r->confirm > -AUTORANGE_CONFIRM)
+      return;
+    r->min = r->candidate;
   }
+  else
+  {
+    r->confirm = 0;
+    return;
+  }
+  r->confirm = 0;
+  if ((r->max - r->min) < AUTORANGE_MIN_SPAN)
+    return;
+  rangeApplied |= 1 << index;
+  trim_cache(index);
+  rangeStable = 0;
+}
+#endif // ifdef _AUTO_RANGING_
+
+
+#ifdef _NOISE_STATS_
+/* ########################################################################## */
+// noise statistics of a pot over a window, the pots take turns; sums of
+// deviations from a reference close to the mean (shifted data) keep the
+// numbers small, no division but by the window size; the reference is the
+// mean of the window before, if the first sample is out of reach of it the
+// sample becomes the mean; a deviation beyond STATS_DEVIATION_LIMIT (a jump)
+// counts at the limit and saturates the variance of the window
+void noise_stats (uint8_t index, uint16_t rawValue)
+{
+  if (index != statsPot)
+    return;
+  if (rawValue > CAPTURE_LIMIT)
+    rawValue = CAPTURE_LIMIT + 1;
+  int16_t deviation = rawValue - ((noise[index].mean + 2) >> 2);
+  if (!statsCount)
+  {
+    if ((deviation > STATS_DEVIATION_LIMIT) || (deviation < -STATS_DEVIATION_LIMIT))
+    {
+      cli();
+      noise[index].mean = rawValue << 2;
+      sei();
+      deviation = 0;
+    }
+    statsSum = 0;
+    statsSquares = 0;
+    statsMin = STATS_DEVIATION_LIMIT;
+    statsMax = -STATS_DEVIATION_LIMIT;
+  }
+  if (deviation > STATS_DEVIATION_LIMIT)
+  {
+    deviation = STATS_DEVIATION_LIMIT;
+    statsSquares = STATS_SATURATED;
+  }
+  else if (deviation < -STATS_DEVIATION_LIMIT)
+  {
+    deviation = -STATS_DEVIATION_LIMIT;
+    statsSquares = STATS_SATURATED;
+  }
+  else if (statsSquares != STATS_SATURATED)
+    statsSquares += (uint16_t)(deviation * deviation);
+  statsSum += deviation;
+  if (deviation < statsMin)
+    statsMin = deviation;
+  if (deviation > statsMax)
+    statsMax = deviation;
+  if (++statsCount < (1 << STATS_WINDOW_SHIFT))
+    return;
+  /* window complete: publish and go on with the next pot */
+  statsCount = 0;
+  uint16_t mean = noise[index].mean + 2;
+  mean = (mean & ~3) + (statsSum >> (STATS_WINDOW_SHIFT - 2));
+  int8_t offset = statsSum >> STATS_WINDOW_SHIFT; /* floor of mean */
+  uint32_t spread = 0xFFFF;
+  if (statsSquares != STATS_SATURATED)
+  { /* |statsSum| <= 2^STATS_WINDOW_SHIFT * STATS_DEVIATION_LIMIT then */
+    spread = statsSquares \
+      - (uint32_t)(((int32_t) statsSum * statsSum) >> STATS_WINDOW_SHIFT);
+    spread = (spread << 4) >> STATS_WINDOW_SHIFT;
+    if (spread > 0xFFFF)
+      spread = 0xFFFF;
+  }
+  cli();
+  noise[index].mean = mean;
+  noise[index].variance = spread;
+  noise[index].below = offset - statsMin;
+  noise[index].above = statsMax - offset;
+  sei();
+  if (++statsPot >= POT_CHANNELS)
+    statsPot = JOY1_X_INDEX;
+}
+#endif // ifdef _NOISE_STATS_
+
+
+#ifdef _CAPTURE_RECORDER_
+/* ########################################################################## */
+// read out of the recorder (USI IRQ): state at start, then the samples held,
+// oldest first, a sample is removed with its last byte
+uint8_t recorder_read (uint8_t start)
+{
+  static uint8_t byteIndex;
+  if (start)
+  {
+    byteIndex = 0;
+    return (recState | recCount);
+  }
+  if (!recCount)
+    return (~0);
+  uint8_t oldest = (recHead - recCount) & (RECORDER_SIZE - 1);
+  uint16_t tagged = recTagged[oldest];
+  switch (byteIndex++)
+  {
+    case 0:
+      return (lsb((void*) &tagged));
+    case 1:
+      return (msb((void*) &tagged));
+    default:
+      byteIndex = 0;
+      recCount--;
+      return (recStamp[oldest]);
+  }
+}
+#endif // ifdef _CAPTURE_RECORDER_
+
+
+/* ########################################################################## */
+// TWI slave hooks - called by USI interrupt engine (see i2c.h)
+// command byte written by master: select data to be read out or hand over
+// calibration request to main loop
+void twi_slaveReceiveHook (char data, char first)
+{
+  if (!first)
+    return; // register map is read only
+  switch ((uint8_t) data)
+  {
+    case setJoy1UpperLeftCorner:
+    case setJoy1LowerRightCorner:
+    case setJoy1ConversionFactor:
+    case setJoy2UpperLeftCorner:
+    case setJoy2LowerRightCorner:
+    case setJoy2ConversionFactor:
+#ifdef _AUTO_RANGING_
+    case setJoyAutoRange:
+#endif // ifdef _AUTO_RANGING_
+#ifdef _PERF_COUNTERS_
+    case clearJoyCounters:
+#endif // ifdef _PERF_COUNTERS_
+      calibrationRequest = data;
+      break;
+    // former read commands preset the pointer
+    case readJoyAll:
+      twiPointer = regJoyAll;
+      break;
+    case readJoy1_X:
+    case readJoy1_Y:
+    case readJoy2_X:
+    case readJoy2_Y:
+    case readJoyPBs:
+      twiPointer = regJoyAll + JOY1_X_INDEX + (data - readJoy1_X);
+      break;
+    case readJoyAllRaw:
+      twiPointer = regJoyAllRaw;
+      break;
+    case readJoyTrimSetting:
+      twiPointer = regJoyTrimSetting;
+      break;
+#ifdef _OVERSAMPLING_
+    case readJoyAllFine:
+      twiPointer = regJoyAllFine;
+      break;
+#endif // ifdef _OVERSAMPLING_
+#ifdef _BUTTON_EVENTS_
+    case readJoyButtonEvents:
+      twiPointer = regJoyButtonEvents;
+      break;
+#endif // ifdef _BUTTON_EVENTS_
+#ifdef _CAPTURE_RECORDER_
+    case armJoyRecorder:
+      recHead = 0;
+      recCount = 0;
+      recState = JOY_RECORDER_RUNNING;
+      break;
+    case triggerJoyRecorder:
+      if ((recState & (JOY_RECORDER_RUNNING | JOY_RECORDER_TRIGGERED)) \
+        == JOY_RECORDER_RUNNING)
+      {
+        recPost = RECORDER_POST_TRIGGER;
+        recState |= JOY_RECORDER_TRIGGERED;
+      }
+      break;
+    case readJoyRecorder:
+      twiPointer = regJoyRecorder;
+      break;
+#endif // ifdef _CAPTURE_RECORDER_
+#ifdef _PERF_COUNTERS_
+    case readJoyCounters:
+      twiPointer = regJoyCounters;
+      break;
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _NOISE_STATS_
+    case readJoyNoiseStats:
+      twiPointer = regJoyNoiseStats;
+      break;
+#endif // ifdef _NOISE_STATS_
+    default:
+      if (((uint8_t) data >= regJoyAll) && ((uint8_t) data < regJoyMapEnd))
+        twiPointer = data;
+#if defined _PERF_COUNTERS_ || defined _NOISE_STATS_
+      else if (((uint8_t) data >= regJoyCounters) \
+        && ((uint8_t) data < regJoyDiagnosticsEnd))
+        twiPointer = data;
+#endif
+      else /* read command of a feature left out, unknown command */
+        twiPointer = regJoyMapEnd;
+  }
+}
+
+
+// next byte requested by master, 'first' is set at start of a read access
+// reads auto-increment through the register map starting at twiPointer
+char twi_slaveTransmitHook (char first)
+{
+  static uint8_t reg;
+  static uint16_t rawValue;
+#ifdef _CAPTURE_RECORDER_
+  static uint8_t recorderStart;
+#endif // ifdef _CAPTURE_RECORDER_
+#ifdef _BUTTON_EVENTS_
+  static uint8_t eventsStart;
+#endif // ifdef _BUTTON_EVENTS_
+  uint8_t data = ~0;
+  if (first)
+  {
+    reg = twiPointer;
+#ifdef _CAPTURE_RECORDER_
+    recorderStart = 1;
+#endif // ifdef _CAPTURE_RECORDER_
+#ifdef _BUTTON_EVENTS_
+    eventsStart = 1;
+#endif // ifdef _BUTTON_EVENTS_
+    twiFrame = frontFrame; // stick to this frame during the burst
+  }
+  if (reg < regJoyAll + FRAME_SIZE)
+  {
+    data = frame[twiFrame][reg - regJoyAll];
+#ifdef _CHANGE_NOTIFICATION_
+    RELEASE_CHANGE_LINE;
+    changeRead = twiFrame;
+#endif // ifdef _CHANGE_NOTIFICATION_
+  }
+  else if (reg < regJoyAllRaw + 2 * (RESULT_SIZE - 1))
+  {
+    uint8_t j = reg - regJoyAllRaw;
+    if (first || !(j & 0x01))
+      // take both bytes from the same sample
+      rawValue = captured[j >> 1];
+    if (j & 0x01)
+      data = msb((void*) &rawValue);
+    else
+      data = lsb((void*) &rawValue);
+  }
+  else if (reg < regJoyTrimSetting + sizeof(struct trim_data) * (RESULT_SIZE - 1))
+  {
+    if (!storePending) /* EEPROM busy else */
+      data = trim_byte(reg - regJoyTrimSetting);
+  }
+  else if (reg == regJoyStatus)
+  {
+    data = 0;
+    if (storePending)
+      data |= JOY_STATUS_TRIM_PENDING;
+    if ((EECR & ((1 << EERIE) | (1 << EEPE))))
+      data |= JOY_STATUS_EEPROM_BUSY;
+    if (calibrationRequest)
+      data |= JOY_STATUS_CALIBRATING;
+#ifdef _AUTO_RANGING_
+    if (rangeApplied)
+      data |= JOY_STATUS_LEARNING;
+#endif // ifdef _AUTO_RANGING_
+#ifdef _WATCHDOG_
+    if (resetCause & (1 << WDRF))
+      data |= JOY_STATUS_WATCHDOG_RESET;
+#endif // ifdef _WATCHDOG_
+  }
+#ifdef _OVERSAMPLING_
+  else if (reg <= regJoyAllFineEnd)
+  {
+    uint8_t j = reg - regJoyAllFine;
+    if (first || !(j & 0x01))
+      rawValue = fine[j >> 1];
+    if (j & 0x01)
+      data = msb((void*) &rawValue);
+    else
+      data = lsb((void*) &rawValue);
+  }
+#endif // ifdef _OVERSAMPLING_
+#ifdef _ALSO_USE_UART_
+  else if (reg == regJoyUartOverruns)
+    data = rxOverruns;
+  else if (reg == regJoyUartFrameErrors)
+    data = rxFrameErrors;
+#endif // ifdef _ALSO_USE_UART_
+#ifdef _PERF_COUNTERS_
+  else if (reg == regJoyDroppedSamples)
+    data = droppedSamples;
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _CAPTURE_RECORDER_
+  else if (reg == regJoyRecorder)
+  {
+    data = recorder_read(recorderStart);
+    recorderStart = 0;
+  }
+#endif // ifdef _CAPTURE_RECORDER_
+#ifdef _BUTTON_EVENTS_
+  else if (reg == regJoyButtonEvents)
+  {
+    data = button_events_read(eventsStart);
+    eventsStart = 0;
+  }
+#endif // ifdef _BUTTON_EVENTS_
+#ifdef _PERF_COUNTERS_
+  else if ((reg >= regJoyCounters) && (reg <= regJoyCountersEnd))
+  {
+    uint8_t j = reg - regJoyCounters;
+    if (first || !(j & 0x01))
+      rawValue = ((volatile uint16_t*) &perf)[j >> 1];
+    if (j & 0x01)
+      data = msb((void*) &rawValue);
+    else
+      data = lsb((void*) &rawValue);
+  }
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _NOISE_STATS_
+  else if ((reg >= regJoyNoiseStats) && (reg <= regJoyNoiseStatsEnd))
+  {
+    uint8_t j = reg - regJoyNoiseStats;
+    if (first || !(j & 0x01))
+      rawValue = ((volatile uint16_t*) &noise[0])[j >> 1];
+    if (j & 0x01)
+      data = msb((void*) &rawValue);
+    else
+      data = lsb((void*) &rawValue);
+  }
+#endif // ifdef _NOISE_STATS_
+  /* the pointer gets no further than into the map or the diagnostics */
+  if ((reg != regJoyMapEnd) && (reg != regJoyDiagnosticsEnd) \
+    && (reg != regJoyRecorder) && (reg != regJoyButtonEvents))
+    reg++;
+  if (reg > regJoyAll + FRAME_SIZE - 1)
+    twiFrame = NO_FRAME;
+  return (data);
 }
 
 
 /* ########################################################################## */
 // main program control:
 // converts raw time stamps (resistance readings) to desired output range
-// handles TWI traffic
+// handles TWI calibration requests (TWI traffic itself is done by IRQ)
 int main(void)
 {
-  uint8_t result[RESULT_SIZE];
+  uint8_t c;
+#ifdef _WATCHDOG_
+  /* keep the reset cause, flags accumulate until cleared */
+  resetCause = MCUSR;
+  MCUSR = 0;
+  wdt_enable(WATCHDOG_PERIOD);
+#endif // ifdef _WATCHDOG_
   result[JOYPBS_INDEX] = 0;
+  /* pots not scanned read as not connected */
+  for (c = POT_CHANNELS; c < RESULT_SIZE-1; c++)
+  {
+    captured[c] = ~0;
+    result[c] = ABSOLUTE_MAX_READING;
+    result[JOYPBS_INDEX] |= 1 << (c + 4);
+  }
   /* set up IO ports */
-  BUTTON_PORT |= (BUTTON4_BIT | BUTTON3_BIT | BUTTON2_BIT | BUTTON1_BIT);
+  INIT_BUTTON_PORTS;
   START_DISCHARGING;
   /* set up analog comparator */
   DIDR |= (1<<AIN1D) | (1<<AIN0D); // disable digital input on AIN1 and AIN0
   ACSR = 1 << ACIC; // enable comparator, use external reference, no IRQs, ICP
+#ifdef _PERF_COUNTERS_
+  perf_clear();
+#endif // ifdef _PERF_COUNTERS_
+  /* find trim data */
+  trim_load();
+#ifdef _AUTO_RANGING_
+  /* learning goes on from the stored range */
+  for (c = JOY1_X_INDEX; c < RESULT_SIZE-1; c++)
+  {
+    struct trim_data t;
+    trim_get(c, &t);
+    range[c].min = t.min_resi;
+    range[c].max = t.max_resi;
+  }
+#endif // ifdef _AUTO_RANGING_
   /* set up TWI service */
-  setupTwiBus(0);
+  setupTwiBus(TWI_BASE_address);
 #ifdef _ALSO_USE_UART_
   /* set up UART */
   initCom();
+#elif defined _CHANGE_NOTIFICATION_
+  /* spare IO is the data changed line */
+  INIT_CHANGE_LINE;
 #else
   /* set unused IO to drive GND!!!
      ========================== */
   NC_PORT1 &= ~NC_BITS1;
-  NC_DDR1 |= NC_BITS;
+  NC_DDR1 |= NC_BITS1;
 #endif // __AVR_ATtiny2313__
   /* set up timer 0 as desired (button debouncing) */
   INIT_T0;
@@ -433,186 +2038,223 @@ int main(void)
   /* finally start interrupt system */
   sei();
   /* now main loop takes over */
-  uint8_t j;
-  char x;
-  char c=0;
-  uint8_t twi_todo = 0;
+  uint8_t publishPending = 0;
   while (1)
   {
-    /* ==== TWI handling ==== */
-    x = TWI_BASE_address;
-    if (twi_getaddressSlave(&x, 0b11111110) != (char) __twiFail__)
+#ifdef _WATCHDOG_
+    wdt_reset();
+#endif // ifdef _WATCHDOG_
+#ifdef _PERF_COUNTERS_
+    loopCount++;
+#endif // ifdef _PERF_COUNTERS_
+    /* ==== TWI handling (calibration requests, anything else by IRQ) ==== */
+    /* requests wait while trims are written (see trim_store) */
+    c = 0;
+    cli();
+    if (!storePending)
     {
-      if ((x & __twiRead__) == __twiRead__)
-        /* read access */
-        switch (twi_todo)
-        {
-          case readJoyAll:
-            j = JOY1_X_INDEX;
-            while (!twi_sendByteSlave(result[j++]))
-            {
-              if (j >= RESULT_SIZE)
-                j = JOY1_X_INDEX;
-            }
-            break;
-          case readJoy1_X:
-            while (!twi_sendByteSlave(result[JOY1_X_INDEX])) {}
-            break;
-          case readJoy1_Y:
-            while (!twi_sendByteSlave(result[JOY1_Y_INDEX])) {}
-            break;
-          case readJoy2_X:
-            while (!twi_sendByteSlave(result[JOY2_X_INDEX])) {}
-            break;
-          case readJoy2_Y:
-            while (!twi_sendByteSlave(result[JOY2_Y_INDEX])) {}
-            break;
-          case readJoyPBs:
-            while (!twi_sendByteSlave(result[JOYPBS_INDEX])) {}
-            break;
-          case readJoyAllRaw:
-            j = JOY1_X_INDEX;
-            while (1)
-            {
-              cli();
-              uint8_t lsbByte = lsb((void*) &captured[j]);
-              uint8_t msbByte = msb((void*) &captured[j]);
-              sei();
-              if (twi_sendByteSlave(lsbByte))
-                break;
-              if (twi_sendByteSlave(msbByte))
-                break;
-              if (++j >= (RESULT_SIZE - 1))
-                j = JOY1_X_INDEX;
-            }
-            break;
-          case readJoyTrimSetting:
-            j = JOY1_X_INDEX;
-            unsigned int base = (unsigned int) &joyTrim[JOY1_X_INDEX];
-            while (!twi_sendByteSlave(EEPROM_read_byte(base + j)))
-            {
-              if (++j >= sizeof(joyTrim))
-                j = JOY1_X_INDEX;
-            }
-            break;
-          default:
-            twi_todo = readJoyAll;
-        }
-      else
-      {
-        /* write access */
-        while (!twi_receiveByteSlave(&c)) {}
-        switch (c)
-        {
-          case setJoy1UpperLeftCorner:
-            /* ATTENTION: stick needs to be in the upper left corner! */
-            cli();
-            uint16_t trim_x_min = captured[JOY1_X_INDEX];
-            uint16_t trim_y_min = captured[JOY1_Y_INDEX];
-            sei();
-            EEPROM_write_word((unsigned int) &joyTrim[JOY1_X_INDEX].min_resi, trim_x_min);
-            EEPROM_write_word((unsigned int) &joyTrim[JOY1_Y_INDEX].min_resi, trim_y_min);
-            twi_todo = readJoyTrimSetting;
-            break;
-          case setJoy1LowerRightCorner:
-            /* ATTENTION: stick needs to be in the lower right corner! */
-            cli();
-            uint16_t trim_x_max = captured[JOY1_X_INDEX];
-            uint16_t trim_y_max = captured[JOY1_Y_INDEX];
-            sei();
-            EEPROM_write_word((unsigned int) &joyTrim[JOY1_X_INDEX].max_resi, trim_x_max);
-            EEPROM_write_word((unsigned int) &joyTrim[JOY1_Y_INDEX].max_resi, trim_y_max);
-            twi_todo = readJoyTrimSetting;
-            break;
-          case setJoy1ConversionFactor:
-            /* ATTENTION: do adjustment of upper left / lower right first! */
-            calculate_trim_factor(JOY1_X_INDEX);
-            calculate_trim_factor(JOY1_Y_INDEX);
-            twi_todo = readJoyTrimSetting;
-            break;
-          case setJoy2UpperLeftCorner:
-            /* ATTENTION: stick needs to be in the upper left corner! */
-            cli();
-            trim_x_min = captured[JOY2_X_INDEX];
-            trim_y_min = captured[JOY2_Y_INDEX];
-            sei();
-            EEPROM_write_word((unsigned int) &joyTrim[JOY2_X_INDEX].min_resi, trim_x_min);
-            EEPROM_write_word((unsigned int) &joyTrim[JOY2_Y_INDEX].min_resi, trim_y_min);
-            twi_todo = readJoyTrimSetting;
-            break;
-          case setJoy2LowerRightCorner:
-            /* ATTENTION: stick needs to be in the lower right corner! */
-            cli();
-            trim_x_max = captured[JOY2_X_INDEX];
-            trim_y_max = captured[JOY2_Y_INDEX];
-            sei();
-            EEPROM_write_word((unsigned int) &joyTrim[JOY2_X_INDEX].max_resi, trim_x_max);
-            EEPROM_write_word((unsigned int) &joyTrim[JOY2_Y_INDEX].max_resi, trim_y_max);
-            twi_todo = readJoyTrimSetting;
-            break;
-          case setJoy2ConversionFactor:
-            /* ATTENTION: do adjustment of upper left / lower right first! */
-            calculate_trim_factor(JOY2_X_INDEX);
-            calculate_trim_factor(JOY2_Y_INDEX);
-            twi_todo = readJoyTrimSetting;
-            break;
-          default:
-            twi_todo = c;
-        }
-      }
+      c = calibrationRequest;
+      calibrationRequest = 0;
+    }
+    sei();
+    switch (c)
+    {
+      case setJoy1UpperLeftCorner:
+        /* ATTENTION: stick needs to be in the upper left corner! */
+        store_corner(JOY1_X_INDEX, offsetof(struct trim_data, min_resi));
+        twiPointer = regJoyTrimSetting;
+        break;
+      case setJoy1LowerRightCorner:
+        /* ATTENTION: stick needs to be in the lower right corner! */
+        store_corner(JOY1_X_INDEX, offsetof(struct trim_data, max_resi));
+        twiPointer = regJoyTrimSetting;
+        break;
+      case setJoy1ConversionFactor:
+        /* ATTENTION: do adjustment of upper left / lower right first! */
+        store_factors(JOY1_X_INDEX);
+        twiPointer = regJoyTrimSetting;
+        break;
+      case setJoy2UpperLeftCorner:
+        /* ATTENTION: stick needs to be in the upper left corner! */
+        store_corner(JOY2_X_INDEX, offsetof(struct trim_data, min_resi));
+        twiPointer = regJoyTrimSetting;
+        break;
+      case setJoy2LowerRightCorner:
+        /* ATTENTION: stick needs to be in the lower right corner! */
+        store_corner(JOY2_X_INDEX, offsetof(struct trim_data, max_resi));
+        twiPointer = regJoyTrimSetting;
+        break;
+      case setJoy2ConversionFactor:
+        /* ATTENTION: do adjustment of upper left / lower right first! */
+        store_factors(JOY2_X_INDEX);
+        twiPointer = regJoyTrimSetting;
+        break;
+#ifdef _AUTO_RANGING_
+      case setJoyAutoRange:
+        /* ATTENTION: trim keeps the old range until the new one is wide! */
+        rangeSeed = POT_CHANNEL_MASK;
+        break;
+#endif // ifdef _AUTO_RANGING_
+#ifdef _PERF_COUNTERS_
+      case clearJoyCounters:
+        cli();
+        perf_clear();
+        sei();
+        break;
+#endif // ifdef _PERF_COUNTERS_
+      default:
+        ;
     }
+    trim_complete();
 #ifdef _ALSO_USE_UART_
     /* ==== UART handling ==== */
     decodeReception();
+    kickTransmitter();
+#ifdef _SEND_ON_CHANGE_
+    sendOnChange(frontFrame);
+#else
     if (!timeout)
     {
       timeout = 230; // approx. 0.8s
-      sendSequence((void*) &result[0], RESULT_SIZE);
+      sendFrame(&result[0]);
     }
+#endif // ifdef _SEND_ON_CHANGE_
 #endif // ifdef _ALSO_USE_UART_
     /* ==== debounced pushbuttons ==== */
     cli();
     uint8_t buttons = key_state & BUTTON_MASK;
     sei();
+    c = result[JOYPBS_INDEX] & ~0x0F; /* 'V' bits stay */
     if (buttons & BUTTON1_BIT)
-      result[JOYPBS_INDEX] |= 0x01;
-    else
-      result[JOYPBS_INDEX] &= ~0x01;
+      c |= 0x01;
     if (buttons & BUTTON2_BIT)
-      result[JOYPBS_INDEX] |= 0x02;
-    else
-      result[JOYPBS_INDEX] &= ~0x02;
+      c |= 0x02;
     if (buttons & BUTTON3_BIT)
-      result[JOYPBS_INDEX] |= 0x04;
-    else
-      result[JOYPBS_INDEX] &= ~0x04;
+      c |= 0x04;
     if (buttons & BUTTON4_BIT)
-      result[JOYPBS_INDEX] |= 0x08;
-    else
-      result[JOYPBS_INDEX] &= ~0x08;
-    /* ==== convert capture result to public output ==== */
-    if (updated)
-    {
+      c |= 0x08;
+    result[JOYPBS_INDEX] = c;
+    /* ==== convert capture results to public output ==== */
+    cli();
+    uint8_t pendingPots = pending;
+    pending = 0;
+    uint8_t whoIsToRescale = whoIsNext + POT_CHANNELS - 1; /* captured last */
+#ifdef _VERIFY_DISCHARGE_
+    uint8_t afterFixed = readyAfterFixed;
+#endif // ifdef _VERIFY_DISCHARGE_
+    sei();
+    while (pendingPots)
+    { /* all pending pots in order of capture, oldest after the last one */
+      if (++whoIsToRescale >= POT_CHANNELS)
+        whoIsToRescale -= POT_CHANNELS;
+      uint8_t bit = 1 << whoIsToRescale;
+      if (!(pendingPots & bit))
+        continue;
+      pendingPots &= ~bit;
       cli();
-      updated = 0;
-      uint8_t whoIsToRescale = whoIsReady;
       uint16_t rawValue = captured[whoIsToRescale];
       sei();
-      if (rawValue <= CAPTURE_LIMIT)
+#ifdef _NOISE_STATS_
+      noise_stats(whoIsToRescale, rawValue);
+#endif // ifdef _NOISE_STATS_
+      uint8_t valid = (rawValue <= CAPTURE_LIMIT);
+#ifdef _VERIFY_RESCALING_
+      if (rescale_capture(whoIsToRescale, rawValue) \
+        != rescale_reference(whoIsToRescale, rawValue))
+        valid = 0;
+#endif // ifdef _VERIFY_RESCALING_
+#ifdef _VERIFY_DISCHARGE_
+      if (afterFixed & bit)
+        verifyRaw[whoIsToRescale] = rawValue;
+      else
       {
-        int16_t rawResult = (int16_t)rawValue - (int16_t)EEPROM_read_word((unsigned int) &joyTrim[whoIsToRescale].min_resi);
-        // allow for better precision multiplying by 6 (= 2 + 4)
-        rawResult = (rawValue << 1) + (rawValue << 2);
-        int16_t conversionResult = rawResult / (int16_t)EEPROM_read_word((unsigned int) &joyTrim[whoIsToRescale].factor);
+        int16_t deviation = rawValue - verifyRaw[whoIsToRescale];
+        if ((deviation > DISCHARGE_VERIFY_TOL) || (deviation < -DISCHARGE_VERIFY_TOL))
+          verifyFailed |= bit;
+        else
+          verifyFailed &= ~bit;
+      }
+      if (verifyFailed & bit)
+        valid = 0; /* 'V' holds over the fixed cycle */
+#endif // ifdef _VERIFY_DISCHARGE_
+      if (valid)
+      {
+#ifdef _AUTO_RANGING_
+        if (!storePending) /* trim stays while it is written */
+          autorange(whoIsToRescale, rawValue);
+#endif // ifdef _AUTO_RANGING_
+#ifdef _OVERSAMPLING_
+        int16_t fineResult = rescale_fine(whoIsToRescale, \
+          oversample(whoIsToRescale, rawValue));
+        int16_t conversionResult = fineResult / (1 << HIRES_SHIFT);
+        fineResult += DESIRED_MIN_READING << HIRES_SHIFT;
+        if (fineResult > (int16_t)(ABSOLUTE_MAX_READING << HIRES_SHIFT))
+          fineResult = ABSOLUTE_MAX_READING << HIRES_SHIFT;
+        else if (fineResult < (int16_t)(ABSOLUTE_MIN_READING << HIRES_SHIFT))
+          fineResult = ABSOLUTE_MIN_READING << HIRES_SHIFT;
+        cli();
+        fine[whoIsToRescale] = fineResult;
+        sei();
+#else
+        int16_t conversionResult = rescale_capture(whoIsToRescale, rawValue);
+#endif // ifdef _OVERSAMPLING_
         conversionResult = conversionResult + DESIRED_MIN_READING;
         if (conversionResult > (int16_t)ABSOLUTE_MAX_READING)
           result[whoIsToRescale] = ABSOLUTE_MAX_READING;
+        else if (conversionResult < (int16_t)ABSOLUTE_MIN_READING)
+          result[whoIsToRescale] = ABSOLUTE_MIN_READING;
         else
           result[whoIsToRescale] = conversionResult;
-        result[JOYPBS_INDEX] &= ~(1 << (whoIsToRescale + 4));
+        result[JOYPBS_INDEX] &= ~(bit << 4);
       }
       else
-        result[JOYPBS_INDEX] |= (1 << (whoIsToRescale + 4));
+      {
+        result[JOYPBS_INDEX] |= (bit << 4);
+#ifdef _OVERSAMPLING_
+        filterSeed |= bit;
+#endif // ifdef _OVERSAMPLING_
+#ifdef _AUTO_RANGING_
+        if (rawValue > CAPTURE_LIMIT)
+          rangeSeed |= bit;
+#endif // ifdef _AUTO_RANGING_
+      }
+      if (whoIsToRescale == POT_CHANNELS - 1)
+      { /* scan cycle complete */
+#ifdef _PERF_COUNTERS_
+        cli();
+        perf.loops = loopCount;
+        if (loopCount < perf.loopsMin)
+          perf.loopsMin = loopCount;
+        sei();
+        loopCount = 0;
+#endif // ifdef _PERF_COUNTERS_
+#ifdef _OVERSAMPLING_
+        if (++ringIndex >= (1 << OVERSAMPLING_SHIFT))
+          ringIndex = 0;
+#endif // ifdef _OVERSAMPLING_
+#ifdef _AUTO_RANGING_
+        if (rangeApplied && !storePending \
+          && (++rangeStable >= AUTORANGE_STABLE_CYCLES))
+          trim_store(NO_PATCH);
+#endif // ifdef _AUTO_RANGING_
+        publishPending = ~0;
+      }
+    }
+    /* ==== frame for TWI ==== */
+#ifdef _CHANGE_NOTIFICATION_
+    cli();
+    c = changeRead;
+    changeRead = NO_FRAME;
+    sei();
+    if (c != NO_FRAME)
+      acknowledge_change(c);
+#endif // ifdef _CHANGE_NOTIFICATION_
+    if (publishPending && publish_frame())
+    {
+      publishPending = 0;
+#ifdef _CHANGE_NOTIFICATION_
+      check_change(frontFrame);
+#endif // ifdef _CHANGE_NOTIFICATION_
     }
   }
   return(0);
@@ -0,0 +1,108 @@
+/******************************************************************************\
+*                                                                              *
+* File        : rescale.h                                                      *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Description : Division by the conversion factor done as multiply and shift   *
+*               (see Granlund/Montgomery, "Division by invariant integers      *
+*               using multiplication"). The reciprocal is calculated once per  *
+*               calibration, each capture then needs a 16 x 16 bit multiply    *
+*               instead of a 16 bit division, both are software on the AVR.    *
+*               For |factor| <= 2^shift the reciprocal                         *
+*                m = ceil(2^(15 + shift) / |factor|) fits 16 bits and          *
+*                n / factor = (n * m) >> (15 + shift)                          *
+*               is bit exact for all |n| < 2^15: m * |factor| exceeds          *
+*               2^(15 + shift) by less than |factor| <= 2^shift. The signs are *
+*               handled apart, so the quotient truncates towards zero like the *
+*               division does. host/rescale.c checks it against the division.  *
+*               The AVR has no multiplier, so both are done bit by bit in 16   *
+*               bit (15 add-and-shift steps for n * m, a long division for m)  *
+*               instead of calling the 32 bit routines of libgcc.              *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __RESCALE_H__
+#define __RESCALE_H__
+
+#include <stdint.h>
+
+#define RESCALE_NEGATIVE        0x80    /* shift: factor is negative */
+
+struct rescale_data {
+  uint16_t reciprocal; /* ceil(2^(15 + shift) / |factor|), 0 for factor 0 */
+  uint8_t  shift;      /* 2^(shift - 1) < |factor| <= 2^shift, sign */
+};
+
+
+// reciprocal of a factor (does the division, so once per calibration only),
+// factor 0 gives quotient 0
+static inline void rescale_reciprocal (int16_t factor, struct rescale_data *r)
+{
+  uint16_t divisor = (factor < 0) ? -factor : factor;
+  uint16_t rest = 1;
+  uint8_t shift = 0;
+  while (rest < divisor)
+  {
+    rest <<= 1;
+    shift++;
+  }
+  /* rest = 2^shift are the leading bits of 2^(15 + shift), 15 0 bits follow,
+     rest stays below 2 * divisor <= 2^16 */
+  uint16_t m = 0;
+  for (uint8_t j = 16; j; j--)
+  {
+    m <<= 1;
+    if (rest >= divisor)
+    {
+      rest -= divisor;
+      m |= 1;
+    }
+    rest <<= 1;
+  }
+  if (rest)
+    m++; /* rounded up */
+  r->reciprocal = divisor ? m : 0;
+  r->shift = (factor < 0) ? (shift | RESCALE_NEGATIVE) : shift;
+}
+
+
+// n / factor for |n| < 2^15, truncated towards zero
+static inline int16_t rescale_divide (int16_t n, const struct rescale_data *r)
+{
+  uint8_t negative = (r->shift & RESCALE_NEGATIVE) ? (n >= 0) : (n < 0);
+  uint16_t a = (n < 0) ? -n : n;
+  /* q = (a * m) >> 15 from the low bit of a up, the bit shifted out of each
+     partial sum is final, the carry of the sum goes back in as its MSB */
+  uint16_t q = 0;
+  for (uint8_t j = 15; j; j--)
+  {
+    if (a & 1)
+    {
+      uint16_t sum = q + r->reciprocal;
+      q = (sum >> 1) | ((sum < q) ? 0x8000 : 0);
+    }
+    else
+      q >>= 1;
+    a >>= 1;
+  }
+  q >>= r->shift & ~RESCALE_NEGATIVE;
+  return (negative ? -(int16_t)q : (int16_t)q);
+}
+
+#endif // #ifndef __RESCALE_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/
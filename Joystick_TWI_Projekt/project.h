@@ -28,6 +28,7 @@ enum
   readJoy2_X,                           /*   3 */
   readJoy2_Y,                           /*   4 */
   readJoyPBs,                           /*   5 */
+  readJoyButtonEvents,                  /*   6, button event FIFO (optional) */
   // (re)centering
   setJoy1UpperLeftCorner = 32,          /*  32 */
   setJoy1LowerRightCorner,              /*  33 */
@@ -35,11 +36,121 @@ enum
   setJoy2UpperLeftCorner,               /*  35 */
   setJoy2LowerRightCorner,              /*  36 */
   setJoy2ConversionFactor,              /*  37 */
+  setJoyAutoRange,                      /*  38, restart range learning of
+                                                 all pots (optional) */
   // debugging (optional)
   readJoyAllRaw = 128,                  /* 128 */
   readJoyTrimSetting,                   /* 129 */
+  readJoyAllFine,                       /* 130 */
+  armJoyRecorder,                       /* 131, clear and record captures */
+  triggerJoyRecorder,                   /* 132, stop after the post trigger
+                                                 samples */
+  readJoyRecorder,                      /* 133 */
+  readJoyCounters,                      /* 134 */
+  clearJoyCounters,                     /* 135, restart all counters */
+  readJoyNoiseStats,                    /* 136 */
 };
 
+enum
+{ /* TWI register map of PC-joystick
+     the first byte written sets the register pointer, a read starts there
+     and increments through the map, each read restarts at the pointer (also
+     after a repeated start); the read commands above are kept as presets of
+     the pointer, each calibration command sets it to regJoyTrimSetting (as
+     older firmware did), the trims read 0xFF until they are stored (see
+     JOY_STATUS_TRIM_PENDING) */
+  regJoyAll = 0x40,                     /* X1, Y1, X2, Y2, PBs, sequence */
+  regJoyAllRaw = regJoyAll + 6,         /* 4 captures, 16 bit, LSB first */
+  regJoyTrimSetting = regJoyAllRaw + 8, /* 4 x min, max, factor, 16 bit, all
+                                           0xFF while they are stored */
+  regJoyStatus = regJoyTrimSetting + 24,/* see JOY_STATUS_... */
+  regJoyAllFine,                        /* 4 filtered pots, 16 bit, LSB first,
+                                           8 bit reading * 2^HIRES_SHIFT, all
+                                           0xFF without oversampling */
+  regJoyAllFineEnd = regJoyAllFine + 7,
+  regJoyUartOverruns,                   /* bytes lost, 0xFF without UART */
+  regJoyUartFrameErrors,                /* damaged bytes, 0xFF without UART */
+  regJoyDroppedSamples,                 /* captures overwritten before the
+                                           main loop took them, saturating,
+                                           0xFF without performance
+                                           counters */
+  regJoyRecorder,                       /* capture recorder, the pointer stays
+                                           here: state (JOY_RECORDER_...),
+                                           then the recorded samples, oldest
+                                           first, 3 bytes each: capture LSB,
+                                           capture MSB (bits 7..6 are the pot
+                                           index), TCNT0 at end of conversion;
+                                           each sample read is removed, all
+                                           0xFF without recorder */
+  regJoyButtonEvents,                   /* button event FIFO, the pointer
+                                           stays here: state (JOY_EVENTS_...),
+                                           timer 0 ticks now, then the events,
+                                           oldest first, 2 bytes each: event
+                                           (JOY_EVENT_...), ticks at the edge;
+                                           ticks count every 4ms (4MHz) and
+                                           wrap; each event read is removed,
+                                           all 0xFF without button events */
+  // ---- insert additional registers above this line! ----
+  regJoyMapEnd,                         /* reads beyond give 0xFF */
+};
+
+enum
+{ /* TWI register map, diagnostics block
+     the map above must end below the debugging commands (128...), so
+     diagnostics continue beyond them; pointer and auto-increment work the
+     same way */
+  regJoyCounters = 0xA0,                /* 16 bit each, LSB first, they wrap,
+                                           all 0xFF without counters:
+                                            main loop passes in the last scan
+                                             cycle,
+                                            fewest passes in a scan cycle,
+                                            TWI transactions addressed to us,
+                                            TWI transactions broken off or
+                                             given up as stalled,
+                                            4 x timeouts (pot 1 ... 4),
+                                            UART frames sent,
+                                            UART messages received (both 0,
+                                             the counters need the UART
+                                             off),
+                                            max. latency of the scan IRQ in
+                                             clocks (IRQs disabled or busy)
+                                           (dropped samples: see
+                                           regJoyDroppedSamples) */
+  regJoyCountersEnd = regJoyCounters + 21,
+  regJoyNoiseStats,                     /* 4 pots x mean (1/4 clocks,
+                                           CAPTURE_LIMIT + 1 is a timeout),
+                                           variance (1/16 clocks^2,
+                                           saturating, 0xFFFF for a window
+                                           with a jump beyond
+                                           STATS_DEVIATION_LIMIT), 16 bit
+                                           each, LSB first, then below and
+                                           above (clocks from the mean down
+                                           to the min and up to the max),
+                                           8 bit each, over the last window
+                                           of each pot, all 0xFF without
+                                           noise statistics */
+  regJoyNoiseStatsEnd = regJoyNoiseStats + 23,
+  // ---- insert additional registers above this line! ----
+  regJoyDiagnosticsEnd,                 /* reads beyond give 0xFF */
+};
+
+/* bits of regJoyStatus */
+#define JOY_STATUS_TRIM_PENDING (1 << 0)  /* trims being stored */
+#define JOY_STATUS_CALIBRATING  (1 << 1)  /* calibration command pending */
+#define JOY_STATUS_EEPROM_BUSY  (1 << 2)  /* EEPROM write queued or under way */
+#define JOY_STATUS_LEARNING     (1 << 3)  /* learned range not stored yet */
+#define JOY_STATUS_WATCHDOG_RESET (1 << 4) /* last reset by the watchdog */
+/* state read first at regJoyRecorder */
+#define JOY_RECORDER_RUNNING    (1 << 7)  /* armed, samples are recorded */
+#define JOY_RECORDER_TRIGGERED  (1 << 6)  /* trigger seen, stops when done */
+#define JOY_RECORDER_COUNT      0x1F      /* samples held */
+/* state read first at regJoyButtonEvents */
+#define JOY_EVENTS_LOST         (1 << 7)  /* FIFO was full, cleared by reading */
+#define JOY_EVENTS_COUNT        0x0F      /* events held */
+/* event byte of regJoyButtonEvents */
+#define JOY_EVENT_PRESSED       (1 << 7)  /* press, release otherwise */
+#define JOY_EVENT_BUTTON        0x0F      /* button bit as in readJoyPBs */
+
 #endif // #ifndef __PROJECT_H__
 
 
@@ -0,0 +1,64 @@
+/******************************************************************************\
+*                                                                              *
+* File        : telemetry.h                                                    *
+* Project     : Remote Control - Joystick_TWI                                  *
+* Author      :                                                                *
+* Initial date:                                                                *
+* Release rev.:                                                                *
+* Copyright   :                                                                *
+* Credits     :                                                                *
+* License     :                                                                *
+* Description : Radio link format of the joystick readings (UART, optional     *
+*               delta frames), shared by sender and receiver.                  *
+*               A frame is:                                                    *
+*                header   - version (upper nibble) and type (lower nibble)     *
+*                sequence - counts up with every frame sent                    *
+*                mask     - bit n set: value n follows, values are X1, Y1, X2, *
+*                           Y2 and pushbuttons (as read by readJoyAll)         *
+*                values   - keyframe: all values (mask 0x1F)                   *
+*                           delta:    axes as signed 8 bit difference to the   *
+*                                     value sent before, pushbuttons as is     *
+*                crc      - CRC-8 (x^8 + x^2 + x + 1, start 0) of all bytes    *
+*                           before                                             *
+*               A receiver applies a delta only on top of the frame with the   *
+*               sequence number just before, after a loss it waits for the     *
+*               next keyframe.                                                 *
+*                                                                              *
+\******************************************************************************/
+
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_KEYFRAME      0
+#define TELEMETRY_DELTA         1
+#define TELEMETRY_HEADER(type)  ((TELEMETRY_VERSION << 4) | (type))
+#define TELEMETRY_VALUES        5       /* X1, Y1, X2, Y2, pushbuttons */
+#define TELEMETRY_BUTTONS       4       /* index of pushbuttons, never delta */
+#define TELEMETRY_ALL           0x1F    /* mask of a keyframe */
+#define TELEMETRY_MAX_SIZE      (3 + TELEMETRY_VALUES + 1)
+
+
+// CRC-8 of the frame, bitwise (no table, FLASH is short)
+static inline uint8_t telemetry_crc8 (uint8_t crc, uint8_t data)
+{
+  crc ^= data;
+  for (uint8_t j = 0; j < 8; j++)
+    crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  return (crc);
+}
+
+#endif // #ifndef __TELEMETRY_H__
+
+
+
+/******************************************************************************
+ *
+ * $Id$
+ *
+ * $Log$
+ *
+ *****************************************************************************/